@@ -50,7 +50,7 @@ CONFIG += link_pkgconfig
 
 link_pkgconfig {
 	message("Config using pkg-config version "$$system(pkg-config --version))
-	PKGCONFIG = flam3 lua
+	PKGCONFIG = flam3 lua libpng
 
 	## The directory that contains flam3-palettes.xml must be set here.  If
 	## your system has pkg-config, this should find the flam3 palettes.
@@ -63,7 +63,7 @@ else {
 	## flam3-palettes.xml file installed by the flam3 package.
         PALETTESDIR = /usr/share/flam3
 	INCLUDEPATH += /usr/include/libxml2
-	LIBS += -L/usr/lib/libxml2 -lflam3 -lm -ljpeg -lxml2 -llua
+	LIBS += -L/usr/lib/libxml2 -lflam3 -lm -ljpeg -lpng -lxml2 -llua
 }
 
 ################################################################################
@@ -241,6 +241,7 @@ HEADERS += \
  src/lua/highlighter.h \
  src/lua/luaeditor.h \
  src/lua/luatype.h \
+ src/lua/renderhandle.h \
  src/selecttrianglewidget.h \
  src/triangledensitywidget.h \
  src/undoring.h \
@@ -258,7 +259,15 @@ HEADERS += \
  src/transformablegraphicsguide.h \
  src/sheeploopwidget.h \
  src/flam3filestream.h \
- src/checkersbrush.h
+ src/checkersbrush.h \
+ src/imageconvert.h \
+ src/batchrenderer.h \
+ src/xformpreview.h \
+ src/pngwriter.h \
+ src/pointcloud.h \
+ src/chaosgame.h \
+ src/frameexporter.h \
+ src/selftest.h
 
 SOURCES += \
  src/qosmic.cpp \
@@ -308,6 +317,7 @@ SOURCES += \
  src/lua/highlighter.cpp \
  src/lua/luaeditor.cpp \
  src/lua/luatype.cpp \
+ src/lua/renderhandle.cpp \
  src/selecttrianglewidget.cpp \
  src/triangledensitywidget.cpp \
  src/undoring.cpp \
@@ -325,7 +335,15 @@ SOURCES += \
  src/transformablegraphicsguide.cpp \
  src/sheeploopwidget.cpp \
  src/flam3filestream.cpp \
- src/checkersbrush.cpp
+ src/checkersbrush.cpp \
+ src/imageconvert.cpp \
+ src/batchrenderer.cpp \
+ src/xformpreview.cpp \
+ src/pngwriter.cpp \
+ src/pointcloud.cpp \
+ src/chaosgame.cpp \
+ src/frameexporter.cpp \
+ src/selftest.cpp
 
 
 TRANSLATIONS += ts/qosmic_fr.ts \
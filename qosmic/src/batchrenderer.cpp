@@ -0,0 +1,261 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QDir>
+#include <QTimer>
+
+#include "batchrenderer.h"
+#include "flam3filestream.h"
+#include "viewerpresetsmodel.h"
+#include "logger.h"
+
+using namespace Util;
+
+BatchRenderer::BatchRenderer()
+: QObject(), r_thread(RenderThread::getInstance()), output_dir("."),
+	genomes(0), ncps(0), file_idx(-1), genome_idx(0), nrendered(0),
+	nfailed(0), total_iters(0.0)
+{
+	request.setType(RenderRequest::File);
+	connect(r_thread, SIGNAL(flameRendered(RenderEvent*)),
+			this, SLOT(flameRenderedAction(RenderEvent*)), Qt::QueuedConnection);
+}
+
+BatchRenderer::~BatchRenderer()
+{
+	freeGenomes();
+}
+
+QString BatchRenderer::usage()
+{
+	return QCoreApplication::translate("CoreApp",
+		"Usage: qosmic --batch [options] file.flam3 [file.flam3 ...]\n\n"
+		"options:\n"
+		"-p, --preset name    use the named viewer preset for the image quality\n"
+		"-s, --size WxH       render the images at this size\n"
+		"-o, --output dir     write the png images to this directory");
+}
+
+bool BatchRenderer::parseArguments(const QStringList& args)
+{
+	// args[0] is the program and args[1] is --batch
+	for (int n = 2 ; n < args.size() ; n++)
+	{
+		QString arg(args[n]);
+		if (arg == "-p" || arg == "--preset"
+			|| arg == "-s" || arg == "--size"
+			|| arg == "-o" || arg == "--output")
+		{
+			if (++n >= args.size())
+			{
+				cerr << QCoreApplication::translate("CoreApp",
+					"Missing value for %1").arg(arg) << endl;
+				return false;
+			}
+			QString value(args[n]);
+			if (arg == "-p" || arg == "--preset")
+			{
+				if (!ViewerPresetsModel::getInstance()->presetNames().contains(value))
+				{
+					cerr << QCoreApplication::translate("CoreApp",
+						"Unknown preset '%1', the presets are: %2").arg(value)
+						.arg(ViewerPresetsModel::getInstance()->presetNames().join(", "))
+						<< endl;
+					return false;
+				}
+				preset_name = value;
+			}
+			else if (arg == "-s" || arg == "--size")
+			{
+				QStringList wh(value.split('x'));
+				if (wh.size() == 2)
+					image_size = QSize(wh[0].toInt(), wh[1].toInt());
+				if (image_size.isEmpty())
+				{
+					cerr << QCoreApplication::translate("CoreApp",
+						"Invalid size '%1'").arg(value) << endl;
+					return false;
+				}
+			}
+			else
+			{
+				if (!QFileInfo(value).isDir())
+				{
+					cerr << QCoreApplication::translate("CoreApp",
+						"Output directory '%1' doesn't exist").arg(value) << endl;
+					return false;
+				}
+				output_dir = value;
+			}
+		}
+		else
+			files << arg;
+	}
+
+	if (files.isEmpty())
+	{
+		cerr << usage() << endl;
+		return false;
+	}
+	return true;
+}
+
+int BatchRenderer::exec()
+{
+	logInfo(QString("BatchRenderer::exec : rendering %1 file(s)").arg(files.size()));
+	total_timer.start();
+	r_thread->start();
+	QTimer::singleShot(0, this, SLOT(renderNext()));
+	int rv = QCoreApplication::exec();
+	r_thread->stop();
+	r_thread->wait();
+
+	double secs = total_timer.elapsed() / 1000.0;
+	cout << QCoreApplication::translate("CoreApp",
+		"rendered %1 image(s) in %2 seconds, %3 samples/sec, %4 failed")
+		.arg(nrendered).arg(secs, 0, 'f', 2)
+		.arg(secs > 0.0 ? total_iters / secs : 0.0, 0, 'g', 4)
+		.arg(nfailed) << endl;
+	return rv == 0 && nfailed == 0 ? 0 : 1;
+}
+
+bool BatchRenderer::loadFile(const QString& name)
+{
+	freeGenomes();
+	QFile file(name);
+	Flam3FileStream s(&file);
+	if (!s.read(&genomes, &ncps))
+	{
+		genomes = 0;
+		ncps = 0;
+		return false;
+	}
+	return true;
+}
+
+void BatchRenderer::freeGenomes()
+{
+	if (genomes)
+	{
+		for (int n = 0 ; n < ncps ; n++)
+			clear_cp(genomes + n, flam3_defaults_on);
+		free(genomes);
+		genomes = 0;
+	}
+	ncps = 0;
+}
+
+QString BatchRenderer::outputName(const QString& name) const
+{
+	QString base(QFileInfo(name).completeBaseName());
+	if (ncps > 1)
+		base += QString("_%1").arg(genome_idx, 4, 10, QChar('0'));
+	return QDir(output_dir).filePath(base + ".png");
+}
+
+/**
+ * Submit the next genome.  The requests are rendered one at a time since
+ * each one gets all of the rendering threads.
+ */
+void BatchRenderer::renderNext()
+{
+	forever
+	{
+		if (genome_idx >= ncps)
+		{
+			if (++file_idx >= files.size())
+			{
+				QCoreApplication::exit(0);
+				return;
+			}
+			genome_idx = 0;
+			if (!loadFile(files[file_idx]))
+			{
+				cerr << QCoreApplication::translate("CoreApp",
+					"Couldn't load file %1").arg(files[file_idx]) << endl;
+				nfailed++;
+				continue;
+			}
+		}
+
+		flam3_genome* g = genomes + genome_idx;
+		bool no_pos_xf = true;
+		for (int n = 0 ; n < g->num_xforms ; n++)
+			if (g->xform[n].density > 0.0)
+			{
+				no_pos_xf = false;
+				break;
+			}
+		if (no_pos_xf)
+		{
+			cerr << QCoreApplication::translate("CoreApp",
+				"%1: genome %2 has no xforms to render")
+				.arg(files[file_idx]).arg(genome_idx) << endl;
+			nfailed++;
+			genome_idx++;
+			continue;
+		}
+
+		request.setGenome(g);
+		request.setSize(image_size.isEmpty() ? QSize(g->width, g->height) : image_size);
+		if (preset_name.isEmpty())
+			request.setImagePresets(*g);
+		else
+			request.setImagePresets(ViewerPresetsModel::getInstance()->preset(preset_name));
+		request.setName(outputName(files[file_idx]));
+		file_timer.start();
+		r_thread->render(&request);
+		return;
+	}
+}
+
+void BatchRenderer::flameRenderedAction(RenderEvent* e)
+{
+	if (e->request() != &request)
+		return;
+	e->accept();
+
+	if (request.failed())
+	{
+		cerr << QCoreApplication::translate("CoreApp",
+			"%1: genome %2 failed: %3")
+			.arg(files[file_idx]).arg(genome_idx).arg(request.error()) << endl;
+		nfailed++;
+		genome_idx++;
+		renderNext();
+		return;
+	}
+
+	const stat_struct& stats = request.stats();
+	double secs = file_timer.elapsed() / 1000.0;
+	double rate = secs > 0.0 ? stats.num_iters / secs : 0.0;
+	cout << QCoreApplication::translate("CoreApp",
+		"%1 -> %2 (%3x%4): %5 seconds, %6 samples/sec")
+		.arg(files[file_idx]).arg(request.name())
+		.arg(request.size().width()).arg(request.size().height())
+		.arg(secs, 0, 'f', 2).arg(rate, 0, 'g', 4) << endl;
+
+	nrendered++;
+	total_iters += stats.num_iters;
+	genome_idx++;
+	renderNext();
+}
@@ -0,0 +1,72 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+#include <QObject>
+#include <QStringList>
+#include <QTime>
+
+#include "renderthread.h"
+
+/**
+ * The BatchRenderer renders the genomes in a list of flam3 files to png
+ * images without opening the main window.  It is used for 'qosmic --batch'.
+ * Each genome is given to the RenderThread as a File request, so every
+ * image is rendered using all of the flam3 threads.
+ */
+class BatchRenderer : public QObject
+{
+	Q_OBJECT
+
+	RenderThread* r_thread;
+	RenderRequest request;
+	QStringList files;
+	QString preset_name;
+	QString output_dir;
+	QSize image_size;
+	flam3_genome* genomes;
+	int ncps;
+	int file_idx;
+	int genome_idx;
+	int nrendered;
+	int nfailed;
+	double total_iters;
+	QTime file_timer;
+	QTime total_timer;
+
+	public:
+		BatchRenderer();
+		~BatchRenderer();
+		bool parseArguments(const QStringList&);
+		int exec();
+		static QString usage();
+
+	private slots:
+		void renderNext();
+		void flameRenderedAction(RenderEvent*);
+
+	private:
+		bool loadFile(const QString&);
+		void freeGenomes();
+		QString outputName(const QString&) const;
+};
+
+#endif // BATCHRENDERER_H
@@ -0,0 +1,624 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <QVector>
+#include <QVarLengthArray>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "chaosgame.h"
+#include "logger.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QOSMIC_X86_SIMD
+#include <immintrin.h>
+// the vector helpers are always inlined, so their ABI doesn't matter
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// the size of the xform selection table blocks that flam3_create_xform_distrib()
+// makes, from flam3's private.h
+#define CHOOSE_XFORM_GRAIN 16384
+#define CHOOSE_XFORM_GRAIN_M1 16383
+
+#define EPS (1e-10)
+
+// the number of points advanced together, and the steps taken before a
+// point is on the attractor.
+#define CHAOSGAME_LANES 1024
+#define CHAOSGAME_FUSE 20
+
+// at most this many variations are used by one xform
+#define CHAOSGAME_MAX_VARS 8
+
+namespace Util
+{
+
+/**
+ * The coefficients and the nonzero variations of an xform.  The variations
+ * that are algebraic in the point are evaluated by the vector kernels, and
+ * the others, which need sin, cos, atan2, or exp, one point at a time.
+ */
+struct XformTable
+{
+	double c[6];
+	double post[6];
+	bool has_post;
+	double color;
+	double color_speed;
+	double opacity; // as adjusted by flam3, the weight of the point
+	int nvec;
+	int vec_var[CHAOSGAME_MAX_VARS];
+	double vec_weight[CHAOSGAME_MAX_VARS];
+	int nscalar;
+	int scalar_var[CHAOSGAME_MAX_VARS];
+	double scalar_weight[CHAOSGAME_MAX_VARS];
+};
+
+// the buffers an xform kernel works in
+struct Scratch
+{
+	double tx[CHAOSGAME_LANES];
+	double ty[CHAOSGAME_LANES];
+	double px[CHAOSGAME_LANES];
+	double py[CHAOSGAME_LANES];
+};
+
+static bool vector_variation(int v)
+{
+	switch (v)
+	{
+		case VAR_LINEAR:
+		case VAR_SPHERICAL:
+		case VAR_HORSESHOE:
+		case VAR_BUBBLE:
+		case VAR_EYEFISH:
+			return true;
+	}
+	return false;
+}
+
+static bool scalar_variation(int v)
+{
+	switch (v)
+	{
+		case VAR_SINUSOIDAL:
+		case VAR_SWIRL:
+		case VAR_POLAR:
+		case VAR_HANDKERCHIEF:
+		case VAR_DISC:
+		case VAR_EXPONENTIAL:
+		case VAR_CYLINDER:
+			return true;
+	}
+	return false;
+}
+
+static bool badvalue(double x)
+{
+	return x != x || x > 1e10 || x < -1e10;
+}
+
+static inline __attribute__((always_inline)) double vsqrt(double a)
+{
+	return sqrt(a);
+}
+
+template <typename V>
+static inline __attribute__((always_inline)) V vsqrt(V a)
+{
+	for (unsigned i = 0 ; i < sizeof(V) / sizeof(double) ; i++)
+		a[i] = sqrt(a[i]);
+	return a;
+}
+
+template <typename V>
+static inline __attribute__((always_inline)) V load(const double* p)
+{
+	V v;
+	memcpy(&v, p, sizeof(V));
+	return v;
+}
+
+template <typename V>
+static inline __attribute__((always_inline)) void store(double* p, V v)
+{
+	memcpy(p, &v, sizeof(V));
+}
+
+/**
+ * The affine part of an xform and its algebraic variations, for the points
+ * starting at i.  These follow the variations in flam3's variations.c.
+ */
+template <typename V>
+static inline __attribute__((always_inline))
+void affine_vars(const XformTable& xf, const double* x, const double* y,
+	Scratch& s, int i)
+{
+	V vx = load<V>(x + i);
+	V vy = load<V>(y + i);
+	V a = xf.c[0] * vx + xf.c[2] * vy + xf.c[4];
+	V b = xf.c[1] * vx + xf.c[3] * vy + xf.c[5];
+	V sumsq = a * a + b * b;
+	V sx = V();
+	V sy = V();
+	for (int k = 0 ; k < xf.nvec ; k++)
+	{
+		double w = xf.vec_weight[k];
+		switch (xf.vec_var[k])
+		{
+			case VAR_LINEAR:
+				sx += w * a;
+				sy += w * b;
+				break;
+			case VAR_SPHERICAL:
+			{
+				V r = w / (sumsq + EPS);
+				sx += r * a;
+				sy += r * b;
+				break;
+			}
+			case VAR_HORSESHOE:
+			{
+				V r = w / (vsqrt(sumsq) + EPS);
+				sx += (a - b) * (a + b) * r;
+				sy += 2.0 * a * b * r;
+				break;
+			}
+			case VAR_BUBBLE:
+			{
+				V r = w / (0.25 * sumsq + 1.0);
+				sx += r * a;
+				sy += r * b;
+				break;
+			}
+			case VAR_EYEFISH:
+			{
+				V r = (w * 2.0) / (vsqrt(sumsq) + 1.0);
+				sx += r * a;
+				sy += r * b;
+				break;
+			}
+		}
+	}
+	store<V>(s.tx + i, a);
+	store<V>(s.ty + i, b);
+	store<V>(s.px + i, sx);
+	store<V>(s.py + i, sy);
+}
+
+/**
+ * The post transform, written back to the points starting at i.
+ */
+template <typename V>
+static inline __attribute__((always_inline))
+void post_affine(const XformTable& xf, const Scratch& s, double* x, double* y, int i)
+{
+	V px = load<V>(s.px + i);
+	V py = load<V>(s.py + i);
+	if (xf.has_post)
+	{
+		store<V>(x + i, xf.post[0] * px + xf.post[2] * py + xf.post[4]);
+		store<V>(y + i, xf.post[1] * px + xf.post[3] * py + xf.post[5]);
+	}
+	else
+	{
+		store<V>(x + i, px);
+		store<V>(y + i, py);
+	}
+}
+
+static void scalar_vars(const XformTable& xf, Scratch& s, int n)
+{
+	for (int i = 0 ; i < n ; i++)
+	{
+		double tx = s.tx[i];
+		double ty = s.ty[i];
+		double sumsq = tx * tx + ty * ty;
+		double px = 0.0;
+		double py = 0.0;
+		for (int k = 0 ; k < xf.nscalar ; k++)
+		{
+			double w = xf.scalar_weight[k];
+			switch (xf.scalar_var[k])
+			{
+				case VAR_SINUSOIDAL:
+					px += w * sin(tx);
+					py += w * sin(ty);
+					break;
+				case VAR_SWIRL:
+				{
+					double c1 = sin(sumsq);
+					double c2 = cos(sumsq);
+					px += w * (c1 * tx - c2 * ty);
+					py += w * (c2 * tx + c1 * ty);
+					break;
+				}
+				case VAR_POLAR:
+					px += w * atan2(tx, ty) * M_1_PI;
+					py += w * (sqrt(sumsq) - 1.0);
+					break;
+				case VAR_HANDKERCHIEF:
+				{
+					double a = atan2(tx, ty);
+					double r = sqrt(sumsq);
+					px += w * r * sin(a + r);
+					py += w * r * cos(a - r);
+					break;
+				}
+				case VAR_DISC:
+				{
+					double a = atan2(tx, ty) * M_1_PI;
+					double r = M_PI * sqrt(sumsq);
+					px += w * sin(r) * a;
+					py += w * cos(r) * a;
+					break;
+				}
+				case VAR_EXPONENTIAL:
+				{
+					double dx = w * exp(tx - 1.0);
+					double dy = M_PI * ty;
+					px += dx * cos(dy);
+					py += dx * sin(dy);
+					break;
+				}
+				case VAR_CYLINDER:
+					px += w * sin(tx);
+					py += w * ty;
+					break;
+			}
+		}
+		s.px[i] += px;
+		s.py[i] += py;
+	}
+}
+
+/**
+ * Apply an xform to n points in place.
+ */
+template <typename V>
+static inline __attribute__((always_inline))
+void apply_xform_lanes(const XformTable& xf, double* x, double* y, Scratch& s, int n)
+{
+	const int lanes = sizeof(V) / sizeof(double);
+	int i = 0;
+	for ( ; i + lanes <= n ; i += lanes)
+		affine_vars<V>(xf, x, y, s, i);
+	for ( ; i < n ; i++)
+		affine_vars<double>(xf, x, y, s, i);
+
+	if (xf.nscalar > 0)
+		scalar_vars(xf, s, n);
+
+	for (i = 0 ; i + lanes <= n ; i += lanes)
+		post_affine<V>(xf, s, x, y, i);
+	for ( ; i < n ; i++)
+		post_affine<double>(xf, s, x, y, i);
+}
+
+typedef void (*xform_applier)(const XformTable&, double*, double*, Scratch&, int);
+
+static void apply_xform_scalar(const XformTable& xf, double* x, double* y, Scratch& s, int n)
+{
+	apply_xform_lanes<double>(xf, x, y, s, n);
+}
+
+#ifdef QOSMIC_X86_SIMD
+
+typedef double v2d __attribute__((vector_size(16)));
+typedef double v4d __attribute__((vector_size(32)));
+
+__attribute__((target("sse2")))
+static void apply_xform_sse2(const XformTable& xf, double* x, double* y, Scratch& s, int n)
+{
+	apply_xform_lanes<v2d>(xf, x, y, s, n);
+}
+
+__attribute__((target("avx2,fma")))
+static void apply_xform_avx2(const XformTable& xf, double* x, double* y, Scratch& s, int n)
+{
+	apply_xform_lanes<v4d>(xf, x, y, s, n);
+}
+
+#endif // QOSMIC_X86_SIMD
+
+struct XformKernels
+{
+	xform_applier apply;
+	const char* name;
+
+	XformKernels() : apply(&apply_xform_scalar), name("scalar")
+	{
+#ifdef QOSMIC_X86_SIMD
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		{
+			apply = &apply_xform_avx2;
+			name = "avx2";
+		}
+		else if (__builtin_cpu_supports("sse2"))
+		{
+			apply = &apply_xform_sse2;
+			name = "sse2";
+		}
+#endif
+	}
+};
+
+// selected once, the render workers may call this concurrently
+static const XformKernels& xform_kernels()
+{
+	static const XformKernels kernels;
+	return kernels;
+}
+
+// flam3 weights the points of an xform by this function of its opacity
+static double adjust_percentage(double in)
+{
+	if (in == 0.0)
+		return 0.0;
+	return std::pow(10.0, -std::log(1.0 / in) / std::log(2.0));
+}
+
+static bool make_table(const flam3_xform* xf, XformTable* t)
+{
+	t->c[0] = xf->c[0][0];
+	t->c[1] = xf->c[0][1];
+	t->c[2] = xf->c[1][0];
+	t->c[3] = xf->c[1][1];
+	t->c[4] = xf->c[2][0];
+	t->c[5] = xf->c[2][1];
+	t->post[0] = xf->post[0][0];
+	t->post[1] = xf->post[0][1];
+	t->post[2] = xf->post[1][0];
+	t->post[3] = xf->post[1][1];
+	t->post[4] = xf->post[2][0];
+	t->post[5] = xf->post[2][1];
+	t->has_post = !(t->post[0] == 1.0 && t->post[1] == 0.0
+		&& t->post[2] == 0.0 && t->post[3] == 1.0
+		&& t->post[4] == 0.0 && t->post[5] == 0.0);
+	t->color = xf->color;
+	t->color_speed = xf->color_speed;
+	t->opacity = adjust_percentage(xf->opacity);
+	t->nvec = 0;
+	t->nscalar = 0;
+	for (int v = 0 ; v < flam3_nvariations ; v++)
+	{
+		double w = xf->var[v];
+		if (w == 0.0)
+			continue;
+		if (vector_variation(v) && t->nvec < CHAOSGAME_MAX_VARS)
+		{
+			t->vec_var[t->nvec] = v;
+			t->vec_weight[t->nvec++] = w;
+		}
+		else if (scalar_variation(v) && t->nscalar < CHAOSGAME_MAX_VARS)
+		{
+			t->scalar_var[t->nscalar] = v;
+			t->scalar_weight[t->nscalar++] = w;
+		}
+		else
+			return false;
+	}
+	return true;
+}
+
+struct ChaosGame::Private
+{
+	QVector<XformTable> xforms;
+	XformTable final;
+	bool has_final;
+	bool chaos;
+	unsigned short* distrib;
+	xform_applier apply;
+	double x[CHAOSGAME_LANES];
+	double y[CHAOSGAME_LANES];
+	double c[CHAOSGAME_LANES];
+	double op[CHAOSGAME_LANES];
+	int last[CHAOSGAME_LANES];
+	double sx[CHAOSGAME_LANES];
+	double sy[CHAOSGAME_LANES];
+	double sc[CHAOSGAME_LANES];
+	int slast[CHAOSGAME_LANES];
+	int fn[CHAOSGAME_LANES];
+	Scratch scratch;
+	int emitted;
+
+	Private() : has_final(false), chaos(false), distrib(0), apply(0), emitted(0)
+	{
+	}
+};
+
+ChaosGame::ChaosGame()
+: d(new Private)
+{
+}
+
+ChaosGame::~ChaosGame()
+{
+	free(d->distrib);
+	delete d;
+}
+
+/**
+ * True if every variation used by the genome is implemented here.
+ */
+bool ChaosGame::supports(const flam3_genome* g)
+{
+	XformTable t;
+	for (int n = 0 ; n < g->num_xforms ; n++)
+	{
+		const flam3_xform* xf = g->xform + n;
+		if (!make_table(xf, &t))
+			return false;
+		// the final xform is always applied here
+		if (g->final_xform_enable && n == g->final_xform_index && xf->opacity != 1.0)
+			return false;
+	}
+	return g->num_xforms > 0;
+}
+
+/**
+ * Build the xform tables for the genome, and move a batch of random points
+ * onto its attractor.  Returns false if the genome isn't supported.
+ */
+bool ChaosGame::prepare(flam3_genome* g, randctx* rc)
+{
+	if (!supports(g))
+		return false;
+
+	free(d->distrib);
+	d->distrib = flam3_create_xform_distrib(g);
+	if (d->distrib == 0)
+		return false;
+
+	d->apply = xform_kernels().apply;
+	d->chaos = g->chaos_enable;
+	d->has_final = g->final_xform_enable;
+	d->xforms.resize(g->num_xforms);
+	for (int n = 0 ; n < g->num_xforms ; n++)
+		make_table(g->xform + n, d->xforms.data() + n);
+	if (d->has_final)
+		make_table(g->xform + g->final_xform_index, &d->final);
+
+	for (int i = 0 ; i < CHAOSGAME_LANES ; i++)
+	{
+		d->x[i] = flam3_random_isaac_11(rc);
+		d->y[i] = flam3_random_isaac_11(rc);
+		d->c[i] = flam3_random_isaac_01(rc);
+		d->op[i] = 0.0;
+		d->last[i] = 0;
+	}
+	for (int n = 0 ; n < CHAOSGAME_FUSE ; n++)
+		step(rc);
+	d->emitted = 0;
+	return true;
+}
+
+/**
+ * Advance each point by one xform.  The points are sorted by the xforms
+ * chosen for them, so that each xform is applied to a contiguous run of
+ * points.  The points are independent, so their order doesn't matter.
+ * Points that escape are restarted at random, and they aren't visible
+ * until the next step.
+ */
+void ChaosGame::step(randctx* rc)
+{
+	Private& p = *d;
+	const int nxforms = p.xforms.size();
+	QVarLengthArray<int, 64> offset(nxforms + 1);
+	for (int k = 0 ; k <= nxforms ; k++)
+		offset[k] = 0;
+
+	for (int i = 0 ; i < CHAOSGAME_LANES ; i++)
+	{
+		int base = p.chaos ? p.last[i] * CHOOSE_XFORM_GRAIN : 0;
+		int fn = p.distrib[base + (irand(rc) & CHOOSE_XFORM_GRAIN_M1)];
+		p.fn[i] = fn;
+		offset[fn + 1]++;
+	}
+	for (int k = 0 ; k < nxforms ; k++)
+		offset[k + 1] += offset[k];
+
+	QVarLengthArray<int, 64> next(nxforms);
+	for (int k = 0 ; k < nxforms ; k++)
+		next[k] = offset[k];
+	for (int i = 0 ; i < CHAOSGAME_LANES ; i++)
+	{
+		int dst = next[p.fn[i]]++;
+		p.sx[dst] = p.x[i];
+		p.sy[dst] = p.y[i];
+		p.sc[dst] = p.c[i];
+	}
+	memcpy(p.x, p.sx, sizeof(p.x));
+	memcpy(p.y, p.sy, sizeof(p.y));
+	memcpy(p.c, p.sc, sizeof(p.c));
+
+	for (int k = 0 ; k < nxforms ; k++)
+	{
+		int start = offset[k];
+		int n = offset[k + 1] - start;
+		if (n == 0)
+			continue;
+		const XformTable& xf = p.xforms[k];
+		p.apply(xf, p.x + start, p.y + start, p.scratch, n);
+		for (int i = start ; i < start + n ; i++)
+		{
+			p.c[i] = xf.color_speed * xf.color + (1.0 - xf.color_speed) * p.c[i];
+			p.op[i] = xf.opacity;
+			p.last[i] = k + 1;
+		}
+	}
+
+	for (int i = 0 ; i < CHAOSGAME_LANES ; i++)
+		if (badvalue(p.x[i]) || badvalue(p.y[i]))
+		{
+			p.x[i] = flam3_random_isaac_11(rc);
+			p.y[i] = flam3_random_isaac_11(rc);
+			p.op[i] = 0.0;
+		}
+}
+
+/**
+ * Write n samples in the same layout as flam3_iterate(): the x and y
+ * coordinates, the color index, and the opacity of each point.  Samples
+ * of escaped points have zero opacity.
+ */
+void ChaosGame::iterate(int n, double* samples, randctx* rc)
+{
+	Private& p = *d;
+	double ox[CHAOSGAME_LANES];
+	double oy[CHAOSGAME_LANES];
+	while (n > 0)
+	{
+		if (p.emitted == CHAOSGAME_LANES)
+		{
+			step(rc);
+			p.emitted = 0;
+		}
+		int m = qMin(n, CHAOSGAME_LANES - p.emitted);
+		const int from = p.emitted;
+		memcpy(ox + from, p.x + from, m * sizeof(double));
+		memcpy(oy + from, p.y + from, m * sizeof(double));
+		if (p.has_final)
+			p.apply(p.final, ox + from, oy + from, p.scratch, m);
+
+		for (int i = from ; i < from + m ; i++, samples += 4)
+		{
+			double c = p.c[i];
+			if (p.has_final)
+				c = p.final.color_speed * p.final.color
+					+ (1.0 - p.final.color_speed) * c;
+			samples[0] = ox[i];
+			samples[1] = oy[i];
+			samples[2] = c;
+			samples[3] = badvalue(ox[i]) || badvalue(oy[i]) ? 0.0 : p.op[i];
+		}
+		p.emitted += m;
+		n -= m;
+	}
+}
+
+const char* ChaosGame::kernel()
+{
+	return xform_kernels().name;
+}
+
+}
@@ -0,0 +1,58 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef CHAOSGAME_H
+#define CHAOSGAME_H
+
+#include "flam3util.h"
+
+namespace Util
+{
+	/**
+	 * Runs the chaos game for a genome in-tree, as a faster alternative to
+	 * flam3_iterate() for interactive previews.  A batch of independent
+	 * points is advanced together.  Each step the points are sorted by the
+	 * xform chosen for them, and each xform is applied to its points from
+	 * structure-of-arrays tables, with AVX2 or SSE2 kernels when the cpu
+	 * supports them.  Only the common variations are implemented.  Genomes
+	 * that use any other variation are not supported, and they should be
+	 * iterated with libflam3 instead.
+	 */
+	class ChaosGame
+	{
+		public:
+			ChaosGame();
+			~ChaosGame();
+			static bool supports(const flam3_genome*);
+			bool prepare(flam3_genome*, randctx*);
+			void iterate(int, double*, randctx*);
+			static const char* kernel();
+
+		private:
+			struct Private;
+			Private* d;
+
+			void step(randctx*);
+
+			ChaosGame(const ChaosGame&);
+			ChaosGame& operator=(const ChaosGame&);
+	};
+}
+
+#endif // CHAOSGAME_H
@@ -39,12 +39,11 @@ DirectoryViewWidget::DirectoryViewWidget(QWidget* parent)
 
 	QStringList filters;
 	filters << "*.flam3" << "*.flam" << "*.flame" << "*.lua";
-	model = new QFileSystemModel();
+	iconProvider = new FlamFileIconProvider;
+	model = new FlamFileSystemModel(iconProvider);
 	model->setNameFilters(filters);
 	model->setFilter(QDir::AllEntries | QDir::AllDirs | QDir::NoDotAndDotDot);
 	model->setNameFilterDisables(false);
-	iconProvider = new FlamFileIconProvider;
-	model->setIconProvider(iconProvider);
 	model->setRootPath(path);
 
 	m_dirListView->setIconSize(QSize(icon_size, icon_size));
@@ -131,8 +130,8 @@ void DirectoryViewWidget::selectFileAction(const QModelIndex& idx)
 
 DirectoryViewWidget::~DirectoryViewWidget()
 {
-	delete iconProvider;
 	delete model;
+	delete iconProvider;
 	delete comboListModel;
 }
 
@@ -18,10 +18,22 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QTime>
+#include <cstdio>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
 #include "qosmic.h"
 #include "flam3filestream.h"
 #include "logger.h"
 
+// milliseconds to wait for more changes before writing the autosave file
+#define AUTOSAVE_DELAY 750
+
 Flam3FileStream::Flam3FileStream(QFile* f)
 : m_file(f)
 {
@@ -133,22 +145,186 @@ bool Flam3FileStream::write(flam3_genome* genomes, int ngenomes)
 		genomes[0].symmetry = n;
 	}
 
+#ifdef Q_OS_UNIX
+	fflush(fd);
+	fsync(fileno(fd));
+#endif
 	int rv = fclose(fd);
 	m_file->close();
 	return rv == 0;
 }
 
+
+/**
+ * Writes snapshots of a genome vector to the autosave file from a background
+ * thread.  A snapshot submitted while another one is still waiting replaces
+ * it, so a burst of changes is written once after it settles.  The file is
+ * written to a temporary name and renamed over the old autosave file, so a
+ * crash never leaves a truncated autosave behind.
+ */
+class AutoSaveThread : public QThread
+{
+	flam3_genome* pending;
+	int npending;
+	bool running;
+	bool flushing;
+	bool writing;
+	QTime stamp;
+	QMutex mutex;
+	QWaitCondition changed;
+	QWaitCondition idle;
+
+	static void freeSnapshot(flam3_genome* g, int n)
+	{
+		for (int i = 0 ; i < n ; i++)
+			clear_cp(g + i, flam3_defaults_on);
+		free(g);
+	}
+
+	static void writeSnapshot(flam3_genome* g, int n)
+	{
+		QString tmp(QOSMIC_AUTOSAVE + ".tmp");
+		QFile file(tmp);
+		Flam3FileStream s(&file);
+		if (!s.write(g, n))
+		{
+			logWarn(QString("AutoSaveThread::writeSnapshot : couldn't write '%1'")
+					.arg(tmp));
+			file.remove();
+			return;
+		}
+		// rename() atomically replaces the old autosave file
+		if (rename(QFile::encodeName(tmp).constData(),
+			QFile::encodeName(QOSMIC_AUTOSAVE).constData()) != 0)
+		{
+			logWarn(QString("AutoSaveThread::writeSnapshot : couldn't rename '%1'")
+					.arg(tmp));
+			file.remove();
+		}
+	}
+
+	public:
+		AutoSaveThread()
+		: pending(0), npending(0), running(true), flushing(false), writing(false)
+		{
+		}
+
+		~AutoSaveThread()
+		{
+			mutex.lock();
+			running = false;
+			changed.wakeAll();
+			mutex.unlock();
+			wait();
+			freeSnapshot(pending, npending);
+		}
+
+		void submit(flam3_genome* g, int n)
+		{
+			QMutexLocker locker(&mutex);
+			if (pending)
+			{
+				logFine("AutoSaveThread::submit : replacing pending snapshot");
+				freeSnapshot(pending, npending);
+			}
+			pending = g;
+			npending = n;
+			stamp.start();
+			if (!isRunning())
+				start(QThread::LowPriority);
+			changed.wakeAll();
+		}
+
+		void flush()
+		{
+			QMutexLocker locker(&mutex);
+			flushing = true;
+			changed.wakeAll();
+			while (pending || writing)
+				idle.wait(&mutex);
+			flushing = false;
+		}
+
+		void cancel()
+		{
+			QMutexLocker locker(&mutex);
+			freeSnapshot(pending, npending);
+			pending = 0;
+			npending = 0;
+			while (writing)
+				idle.wait(&mutex);
+		}
+
+		void run()
+		{
+			QMutexLocker locker(&mutex);
+			while (running || pending)
+			{
+				if (!pending)
+				{
+					changed.wait(&mutex);
+					continue;
+				}
+				int left = AUTOSAVE_DELAY - stamp.elapsed();
+				if (running && !flushing && left > 0)
+				{
+					changed.wait(&mutex, left);
+					continue;
+				}
+				flam3_genome* g = pending;
+				int n = npending;
+				pending = 0;
+				npending = 0;
+				writing = true;
+				locker.unlock();
+				writeSnapshot(g, n);
+				freeSnapshot(g, n);
+				locker.relock();
+				writing = false;
+				idle.wakeAll();
+			}
+		}
+};
+
+static AutoSaveThread& autosave_thread()
+{
+	static AutoSaveThread thread;
+	return thread;
+}
+
 /**
  * A static method that saves the given genome to the autosave file.
  * The type argument gives the conditions for performing a save, and they
  * must match the current settings for the GenomeVector as set by the user.
+ * The genomes are copied, and the file is written later by a background
+ * thread.
  */
 void Flam3FileStream::autoSave(GenomeVector* genomes, int type)
 {
 	if (genomes->autoSave() & type)
 	{
-		QFile file(QOSMIC_AUTOSAVE);
-		Flam3FileStream s(&file);
-		s.write(genomes);
+		int n = genomes->size();
+		if (n < 1)
+			return;
+		flam3_genome* g = (flam3_genome*)calloc(n, sizeof(flam3_genome));
+		for (int i = 0 ; i < n ; i++)
+			flam3_copy(g + i, genomes->data() + i);
+		autosave_thread().submit(g, n);
 	}
 }
+
+/**
+ * Blocks until any pending autosave has been written.
+ */
+void Flam3FileStream::flushAutoSave()
+{
+	autosave_thread().flush();
+}
+
+/**
+ * Discards any pending autosave that hasn't been written yet.
+ */
+void Flam3FileStream::cancelAutoSave()
+{
+	autosave_thread().cancel();
+}
@@ -40,6 +40,8 @@ class Flam3FileStream
 		Flam3FileStream& operator<<(GenomeVector*);
 
 		static void autoSave(GenomeVector*, int =GenomeVector::AlwaysSave);
+		static void flushAutoSave();
+		static void cancelAutoSave();
 };
 
 #endif // FLAM3FILESTREAM_H
@@ -19,6 +19,10 @@
  ***************************************************************************/
 #include <QMap>
 #include <QHash>
+#include <QCryptographicHash>
+#include <QMutex>
+#include <QThreadStorage>
+#include <QAtomicInt>
 #include <cmath>
 #include <ctime>
 #include <clocale>
@@ -97,6 +101,7 @@ namespace Util
 	};
 
 	static QHash<QString, xform_variable_accessor*> xform_variable_accessors;
+	static QList<xform_variable_accessor*> xform_variable_accessor_list;
 
 #define create_xform_variable_accessor(name) \
 	struct xform_variable_accessor_##name : public xform_variable_accessor \
@@ -258,7 +263,8 @@ namespace Util
 
 
 #define add_xform_variable_accessor(name) \
-		xform_variable_accessors.insert(QString(#name), new xform_variable_accessor_##name)
+		xform_variable_accessors.insert(QString(#name), new xform_variable_accessor_##name); \
+		xform_variable_accessor_list.append(xform_variable_accessors.value(QString(#name)))
 
 	void init_xform_variable_accessors()
 	{
@@ -581,6 +587,10 @@ namespace Util
 		return var_names;
 	}
 
+	// setlocale() is process wide, so only one thread at a time may read or
+	// write genomes using the "C" locale.
+	static QMutex locale_mutex;
+
 	char* setup_C_locale()
 	{
 		// force use of "C" locale when reading/writing reals.
@@ -614,6 +624,7 @@ namespace Util
 
 	void write_to_file(FILE* fd, flam3_genome* genome, char* attrs, int edits)
 	{
+		QMutexLocker lock(&locale_mutex);
 		char* locale = setup_C_locale();
 		flam3_print(fd, genome, attrs, edits);
 		replace_C_locale(locale);
@@ -621,6 +632,7 @@ namespace Util
 
 	flam3_genome* read_from_file(FILE* fd, char* fn, int default_flag, int* ncps)
 	{
+		QMutexLocker lock(&locale_mutex);
 		char* locale = setup_C_locale();
 		flam3_genome* g = flam3_parse_from_file(fd, fn, default_flag, ncps);
 		replace_C_locale(locale);
@@ -629,6 +641,7 @@ namespace Util
 
 	flam3_genome* read_xml_string(QString xml, int* ncps)
 	{
+		QMutexLocker lock(&locale_mutex);
 		char* locale = setup_C_locale();
 		flam3_genome* g
             = flam3_parse_xml2(xml.toLatin1().data(),
@@ -725,23 +738,223 @@ namespace Util
 		polarToRect( r, p * M_PI / 180., x, y);
 	}
 
-	randctx* get_isaac_randctx()
+	// the random number service state
+	static QMutex seed_mutex;
+	static bool seed_set = false;
+	static quint32 seed_value = 0;
+	static QAtomicInt stream_counter(0);
+	static QThreadStorage<randctx*> thread_randctx;
+
+	static void use_master_seed(quint32 seed)
+	{
+		seed_value = seed;
+		seed_set = true;
+		stream_counter = 0;
+		// flam3_random01() and flam3_random() use the libc generator
+		srandom(seed);
+		logInfo(QString("Util::master_seed : using master seed %1").arg(seed));
+	}
+
+	/**
+	 * The seed that every isaac stream is derived from.  It's taken from the
+	 * qosmic_seed environment variable if that is set, otherwise from the
+	 * clock.  The seed is logged so that a session can be repeated.
+	 */
+	quint32 master_seed()
+	{
+		QMutexLocker locker(&seed_mutex);
+		if (!seed_set)
+		{
+			bool ok;
+			quint32 seed = QString(getenv("qosmic_seed")).toUInt(&ok);
+			use_master_seed(ok ? seed : (quint32)time(0));
+		}
+		return seed_value;
+	}
+
+	/**
+	 * Replace the master seed, and restart the stream numbering.
+	 */
+	void set_master_seed(quint32 seed)
+	{
+		QMutexLocker locker(&seed_mutex);
+		use_master_seed(seed);
+	}
+
+	/**
+	 * A new stream number.  Streams are numbered in the order that they're
+	 * asked for, so a task that takes its stream on the gui thread gets the
+	 * same numbers every time the session is repeated.
+	 */
+	quint32 next_stream()
 	{
-		static randctx r;
-		static bool init = false;
-		if (init)
-			return &r;
+		master_seed();
+		return (quint32)stream_counter.fetchAndAddOrdered(1);
+	}
 
-		/* Initialize the issac random number generator used by libflam3 */
-		long int default_isaac_seed = (long int)time(0);
-		memset(r.randrsl, 0, RANDSIZ*sizeof(ub4));
+	/**
+	 * Seed an isaac context with a stream derived from the master seed.
+	 * Different streams are independent, and a stream is the same for the
+	 * same master seed.  The seed words are generated with splitmix64.
+	 */
+	void init_randctx(randctx* r, quint32 stream)
+	{
+		quint64 x = ((quint64)master_seed() << 32) | stream;
 		for (int lp = 0; lp < RANDSIZ; lp++)
-			r.randrsl[lp] = default_isaac_seed;
-		irandinit(&r, 1);
-		init = true;
-		return &r;
+		{
+			x += Q_UINT64_C(0x9E3779B97F4A7C15);
+			quint64 z = x;
+			z = (z ^ (z >> 30)) * Q_UINT64_C(0xBF58476D1CE4E5B9);
+			z = (z ^ (z >> 27)) * Q_UINT64_C(0x94D049BB133111EB);
+			r->randrsl[lp] = (ub4)((z ^ (z >> 31)) & 0xffffffff);
+		}
+		irandinit(r, 1);
+	}
+
+	/**
+	 * The isaac context of the calling thread.  Each thread gets its own
+	 * stream the first time it asks, so the contexts are never shared.
+	 */
+	randctx* get_isaac_randctx()
+	{
+		if (!thread_randctx.hasLocalData())
+		{
+			randctx* r = new randctx;
+			init_randctx(r, next_stream());
+			thread_randctx.setLocalData(r);
+		}
+		return thread_randctx.localData();
+	}
+
+
+	static void hash_double(QCryptographicHash& hash, double d)
+	{
+		// -0.0 and 0.0 are the same value
+		if (d == 0.0)
+			d = 0.0;
+		hash.addData((const char*)&d, sizeof(double));
+	}
+
+	static void hash_doubles(QCryptographicHash& hash, const double* d, int n)
+	{
+		for (int i = 0 ; i < n ; i++)
+			hash_double(hash, d[i]);
+	}
+
+	static void hash_int(QCryptographicHash& hash, int i)
+	{
+		hash.addData((const char*)&i, sizeof(int));
+	}
+
+	static void hash_xform(QCryptographicHash& hash, const flam3_xform* xf)
+	{
+		hash_doubles(hash, xf->var, flam3_nvariations);
+		hash_doubles(hash, &xf->c[0][0], 6);
+		hash_doubles(hash, &xf->post[0][0], 6);
+		hash_double(hash, xf->density);
+		hash_double(hash, xf->color);
+		hash_double(hash, xf->color_speed);
+		hash_double(hash, xf->opacity);
+		hash_double(hash, xf->animate);
+		// the parameters of the parametric variations
+		flam3_xform* x = const_cast<flam3_xform*>(xf);
+		foreach (xform_variable_accessor* a, xform_variable_accessor_list)
+			hash_double(hash, a->get_var(x));
+		hash_int(hash, xf->num_motion);
+		for (int n = 0 ; n < xf->num_motion ; n++)
+		{
+			hash_int(hash, xf->motion[n].motion_func);
+			hash_double(hash, xf->motion[n].motion_freq);
+			hash_xform(hash, xf->motion + n);
+		}
 	}
 
+	/**
+	 * Add the fields of a genome that make its attractor and its color
+	 * indexes to a hash: the xforms, the final xform, and the xaos.  The
+	 * camera, the palette, and the quality and tone mapping fields are left
+	 * out.
+	 */
+	void hash_genome_xforms(QCryptographicHash& hash, const flam3_genome* g)
+	{
+		hash_int(hash, g->num_xforms);
+		hash_int(hash, g->final_xform_enable);
+		hash_int(hash, g->final_xform_enable ? g->final_xform_index : -1);
+		hash_int(hash, g->chaos_enable);
+		for (int n = 0 ; n < g->num_xforms ; n++)
+			hash_xform(hash, g->xform + n);
+		if (g->chaos)
+			for (int n = 0 ; n < g->num_xforms ; n++)
+				hash_doubles(hash, g->chaos[n], g->num_xforms);
+	}
+
+	/**
+	 * Add the fields of a genome that change its image to a hash.  The
+	 * fields are listed one by one, so that the struct padding, the
+	 * pointers, the names, and the precalculated values are left out, and
+	 * the copies of a genome have the same hash.  The time is left out too,
+	 * the callers that interpolate genomes add it.  The hash is computed
+	 * without the C locale, so it is safe to use from the render threads.
+	 */
+	void hash_genome(QCryptographicHash& hash, const flam3_genome* g)
+	{
+		hash_genome_xforms(hash, g);
+
+		// the palette
+		for (int n = 0 ; n < 256 ; n++)
+		{
+			hash_double(hash, g->palette[n].index);
+			hash_doubles(hash, g->palette[n].color, 4);
+		}
+		hash_int(hash, g->palette_mode);
+
+		// the camera
+		hash_doubles(hash, g->center, 2);
+		hash_doubles(hash, g->rot_center, 2);
+		hash_double(hash, g->rotate);
+		hash_double(hash, g->pixels_per_unit);
+		hash_double(hash, g->zoom);
+		hash_int(hash, g->width);
+		hash_int(hash, g->height);
+
+		// the quality and the tone mapping
+		hash_double(hash, g->sample_density);
+		hash_int(hash, g->spatial_oversample);
+		hash_int(hash, g->nbatches);
+		hash_int(hash, g->ntemporal_samples);
+		hash_double(hash, g->spatial_filter_radius);
+		hash_int(hash, g->spatial_filter_select);
+		hash_int(hash, g->temporal_filter_type);
+		hash_double(hash, g->temporal_filter_width);
+		hash_double(hash, g->temporal_filter_exp);
+		hash_double(hash, g->estimator);
+		hash_double(hash, g->estimator_minimum);
+		hash_double(hash, g->estimator_curve);
+		hash_double(hash, g->contrast);
+		hash_double(hash, g->brightness);
+		hash_double(hash, g->gamma);
+		hash_double(hash, g->vibrancy);
+		hash_double(hash, g->gam_lin_thresh);
+		hash_double(hash, g->highlight_power);
+		hash_doubles(hash, g->background, 3);
+
+		// how the genome is interpolated with its neighbours
+		hash_int(hash, g->interpolation);
+		hash_int(hash, g->interpolation_type);
+		hash_int(hash, g->palette_interpolation);
+	}
+
+	QByteArray genome_hash(const flam3_genome* g, int ngenomes)
+	{
+		QCryptographicHash hash(QCryptographicHash::Sha1);
+		for (int n = 0 ; n < ngenomes ; n++)
+		{
+			hash_genome(hash, g + n);
+			if (ngenomes > 1)
+				hash_double(hash, g[n].time);
+		}
+		return hash.result();
+	}
 
 	// The static initializer routine to populate the static variables used
 	// by the functions defined above.
@@ -24,6 +24,8 @@
 #include <QTextStream>
 #include <QColor>
 
+class QCryptographicHash;
+
 #undef VERSION
 extern "C" {
 #include "flam3.h"
@@ -59,7 +61,15 @@ namespace Util
 	void polarToRect(double, double, double*, double*);
 	void polarDegToRect(double, double, double*, double*);
 
+	quint32 master_seed();
+	void set_master_seed(quint32);
+	quint32 next_stream();
+	void init_randctx(randctx*, quint32);
 	randctx* get_isaac_randctx();
+
+	void hash_genome_xforms(QCryptographicHash&, const flam3_genome*);
+	void hash_genome(QCryptographicHash&, const flam3_genome*);
+	QByteArray genome_hash(const flam3_genome*, int ngenomes=1);
 }
 
 /**
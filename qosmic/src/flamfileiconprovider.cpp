@@ -19,24 +19,86 @@
  ***************************************************************************/
 #include <QDir>
 #include <QDateTime>
+#include <QRunnable>
+#include <QThread>
 
 #include "flamfileiconprovider.h"
 #include "qosmic.h"
 #include "logger.h"
 
+// rescan a directory listing once it is older than this many milliseconds
+#define DIRSCAN_MAX_AGE 2000
+
+// Scales a png into the icon cache on a pool thread.
+class FlamIconJob : public QRunnable
+{
+	FlamFileIconProvider* provider;
+	QString file;
+	QString image;
+	QString cache;
+
+	public:
+		FlamIconJob(FlamFileIconProvider* p, const QString& f,
+			const QString& i, const QString& c)
+		: provider(p), file(f), image(i), cache(c)
+		{
+		}
+
+		void run()
+		{
+			QImage buf(image);
+			bool ok = !buf.isNull() && buf.scaled(128, 128, Qt::KeepAspectRatio,
+				Qt::SmoothTransformation).save(cache);
+			if (ok)
+				logInfo(QString("FlamIconJob::run : creating icon  %1").arg(cache));
+			provider->iconFinished(file, cache, ok);
+		}
+};
+
+
 FlamFileIconProvider::FlamFileIconProvider()
-: QFileIconProvider(), icons_dir(QOSMIC_USERDIR), has_icons(false)
+: QObject(), QFileIconProvider(), icons_dir(QOSMIC_USERDIR), has_icons(false)
 {
 	QString path("icons");
 	if (!icons_dir.exists(path))
 		icons_dir.mkpath(path);
 	has_icons = icons_dir.cd(path);
+	pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount() / 2, 4));
 	logFine(QString("FlamFileIconProvider::const : icons dir %1").arg(icons_dir.canonicalPath()));
 }
 
 
 FlamFileIconProvider::~FlamFileIconProvider()
 {
+	pool.clear();
+	pool.waitForDone();
+}
+
+
+// List the pngs in a directory and in its cache directory at once, instead
+// of checking each file as it is asked for.  Must be called with the mutex
+// held.
+FlamFileIconProvider::DirScan& FlamFileIconProvider::scanDir(const QDir& dir) const
+{
+	QString path(dir.canonicalPath());
+	DirScan& d = dirs[path];
+	if (d.age.isValid() && !d.age.hasExpired(DIRSCAN_MAX_AGE))
+		return d;
+
+	logFiner(QString("FlamFileIconProvider::scanDir : scanning %1").arg(path));
+	d.images.clear();
+	d.icons.clear();
+	QStringList filter("*.png");
+	foreach (QFileInfo info, dir.entryInfoList(filter, QDir::Files))
+		d.images.insert(info.fileName(), info.lastModified());
+	if (!d.images.isEmpty())
+	{
+		QDir cache_dir(icons_dir.canonicalPath() + path);
+		foreach (QFileInfo info, cache_dir.entryInfoList(filter, QDir::Files))
+			d.icons.insert(info.fileName(), info.lastModified());
+	}
+	d.age.start();
+	return d;
 }
 
 
@@ -48,36 +110,59 @@ QIcon FlamFileIconProvider::icon(const QFileInfo& info) const
 	{
 		QString img_file(file_name);
 		img_file.replace(rex, "png");
-		QFileInfo img(info.dir(), img_file);
 
-		if (!img.exists())
+		QMutexLocker locker(&mutex);
+		DirScan& d = scanDir(info.dir());
+		if (!d.images.contains(img_file))
 			return QFileIconProvider::icon(info);
 
-		QDir cache_dir(icons_dir.canonicalPath() + info.dir().canonicalPath());
-		if (!cache_dir.exists() && !cache_dir.mkpath("."))
-			return QFileIconProvider::icon(info);
-
-		QFileInfo cache_file(cache_dir, img_file);
-
-		if (cache_file.exists() && (cache_file.lastModified() > img.lastModified()))
+		QString dir_path(info.dir().canonicalPath());
+		QString cache(icons_dir.canonicalPath() + dir_path + '/' + img_file);
+		QDateTime img_time(d.images.value(img_file));
+		if (d.icons.contains(img_file) && d.icons.value(img_file) > img_time)
 		{
-			logFiner(QString("FlamFileIconProvider::icon : found cached %1").arg(cache_file.absoluteFilePath()));
-			return QIcon(cache_file.absoluteFilePath());
+			logFiner(QString("FlamFileIconProvider::icon : found cached %1").arg(cache));
+			return QIcon(cache);
 		}
-		else
+
+		QString file(info.absoluteFilePath());
+		if (!pending.contains(file)
+			&& !(failed.contains(file) && failed.value(file) == img_time))
 		{
-			QString cache(cache_file.absoluteFilePath());
-			QImage buf(img.absoluteFilePath());
-			if (!buf.isNull() && buf.scaled(128, 128, Qt::KeepAspectRatio, Qt::SmoothTransformation).save(cache))
-			{
-				logInfo(QString("FlamFileIconProvider::icon : creating icon  %1").arg(cache));
-				return QIcon(cache);
-			}
+			QDir cache_dir(icons_dir.canonicalPath() + dir_path);
+			if (!cache_dir.exists() && !cache_dir.mkpath("."))
+				return QFileIconProvider::icon(info);
+			logFiner(QString("FlamFileIconProvider::icon : queueing %1").arg(file));
+			pending.insert(file);
+			failed.remove(file);
+			pool.start(new FlamIconJob(const_cast<FlamFileIconProvider*>(this),
+				file, info.dir().absoluteFilePath(img_file), cache));
 		}
 	}
 	return QFileIconProvider::icon(info);
 }
 
+// Called from a pool thread once an icon job has finished.
+void FlamFileIconProvider::iconFinished(const QString& file, const QString& cache, bool ok)
+{
+	QMutexLocker locker(&mutex);
+	pending.remove(file);
+	QFileInfo info(file);
+	QString dir_path(info.dir().canonicalPath());
+	if (dirs.contains(dir_path))
+	{
+		DirScan& d = dirs[dir_path];
+		QString img_file(QFileInfo(cache).fileName());
+		if (ok)
+			d.icons.insert(img_file, QFileInfo(cache).lastModified());
+		else
+			failed.insert(file, d.images.value(img_file));
+	}
+	locker.unlock();
+	if (ok)
+		emit iconReady(file, cache);
+}
+
 QIcon FlamFileIconProvider::icon(IconType type) const
 {
 	return QFileIconProvider::icon(type);
@@ -88,3 +173,30 @@ QString FlamFileIconProvider::type(const QFileInfo& info) const
 	return QFileIconProvider::type(info);
 }
 
+
+FlamFileSystemModel::FlamFileSystemModel(FlamFileIconProvider* p, QObject* parent)
+: QFileSystemModel(parent)
+{
+	setIconProvider(p);
+	connect(p, SIGNAL(iconReady(const QString&, const QString&)),
+			this, SLOT(iconReadySlot(const QString&, const QString&)));
+}
+
+QVariant FlamFileSystemModel::data(const QModelIndex& idx, int role) const
+{
+	if (role == Qt::DecorationRole && idx.column() == 0 && !icons.isEmpty())
+	{
+		QString file(filePath(idx));
+		if (icons.contains(file))
+			return icons.value(file);
+	}
+	return QFileSystemModel::data(idx, role);
+}
+
+void FlamFileSystemModel::iconReadySlot(const QString& file, const QString& cache)
+{
+	icons.insert(file, QIcon(cache));
+	QModelIndex idx(index(file));
+	if (idx.isValid())
+		emit dataChanged(idx, idx);
+}
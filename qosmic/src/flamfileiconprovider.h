@@ -21,11 +21,42 @@
 #define FLAMFILEICONPROVIDER_H
 
 #include <QFileIconProvider>
+#include <QFileSystemModel>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QMutex>
+#include <QHash>
+#include <QSet>
 
-class FlamFileIconProvider : public QFileIconProvider
+/**
+ * Provides icons for flam3 files that have a rendered png next to them.  The
+ * png is scaled into an icon cache under QOSMIC_USERDIR.  Icons that are
+ * missing from the cache are built by a small thread pool, and iconReady()
+ * is emitted once each one is written.  The default file icon is returned
+ * until then.
+ */
+class FlamFileIconProvider : public QObject, public QFileIconProvider
 {
+	Q_OBJECT
+
+	// the png files found in a directory and in its icon cache directory
+	struct DirScan
+	{
+		QElapsedTimer age;
+		QHash<QString, QDateTime> images;
+		QHash<QString, QDateTime> icons;
+	};
+
 	QDir icons_dir;
 	bool has_icons;
+	mutable QMutex mutex;
+	mutable QHash<QString, DirScan> dirs;
+	mutable QSet<QString> pending;
+	mutable QHash<QString, QDateTime> failed;
+	mutable QThreadPool pool;
+
+	DirScan& scanDir(const QDir&) const;
 
 	public:
 		FlamFileIconProvider();
@@ -34,6 +65,28 @@ class FlamFileIconProvider : public QFileIconProvider
 		QIcon icon(const QFileInfo& info) const;
 		QIcon icon(IconType type) const;
 		QString type(const QFileInfo& info) const;
+		void iconFinished(const QString&, const QString&, bool);
+
+	signals:
+		void iconReady(const QString& file, const QString& icon);
+};
+
+/**
+ * A QFileSystemModel that shows the icons built in the background by a
+ * FlamFileIconProvider as they arrive.
+ */
+class FlamFileSystemModel : public QFileSystemModel
+{
+	Q_OBJECT
+
+	QHash<QString, QIcon> icons;
+
+	public:
+		FlamFileSystemModel(FlamFileIconProvider*, QObject* =0);
+		QVariant data(const QModelIndex&, int =Qt::DisplayRole) const;
+
+	private slots:
+		void iconReadySlot(const QString&, const QString&);
 };
 
 #endif
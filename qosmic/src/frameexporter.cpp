@@ -0,0 +1,356 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <QFileInfo>
+#include <QDir>
+#include <QRunnable>
+
+#include "frameexporter.h"
+#include "logger.h"
+
+/**
+ * Encodes one rendered frame on the exporter's thread pool.
+ */
+class EncodeFrameJob : public QRunnable
+{
+	FrameExporter* exporter;
+	int frame;
+	QImage image;
+
+	public:
+		EncodeFrameJob(FrameExporter* e, int n, const QImage& img)
+		: exporter(e), frame(n), image(img)
+		{
+		}
+
+		void run()
+		{
+			bool ok;
+			if (exporter->format == FrameExporter::PngFrames)
+				ok = image.save(exporter->framePath(frame), "png");
+			else
+				ok = exporter->writeY4mFrame(frame, image);
+			QMetaObject::invokeMethod(exporter, "frameEncoded",
+				Qt::QueuedConnection, Q_ARG(int, frame), Q_ARG(bool, ok));
+		}
+};
+
+
+FrameExporter::FrameExporter(QObject* parent)
+: QObject(parent), r_thread(RenderThread::getInstance()), genomes(0),
+	ncps(0), format(PngFrames), fps(30), next_frame(0), nrendered(0),
+	nencoded(0), max_backlog(2), running(false), failed(false), y4m_next(0)
+{
+	pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount() / 2, 4));
+	connect(r_thread, SIGNAL(flameRendered(RenderEvent*)),
+			this, SLOT(flameRenderedAction(RenderEvent*)), Qt::QueuedConnection);
+	connect(r_thread, SIGNAL(flameRenderingKilled()),
+			this, SLOT(renderingKilledAction()), Qt::QueuedConnection);
+}
+
+FrameExporter::~FrameExporter()
+{
+	cancel();
+	foreach (RenderRequest* req, requests)
+		delete req;
+	freeGenomes();
+}
+
+/**
+ * Start exporting the frames of a sequence of ncps genomes.  The genomes are
+ * copied, so the caller's sequence may be freed once this returns.  An empty
+ * size renders the frames at the size of the first genome.  The presets give
+ * the image quality.
+ */
+bool FrameExporter::start(const flam3_genome* cps, int n, const QString& file,
+	const QSize& s, const flam3_genome& presets, int rate)
+{
+	if (running || n < 1)
+		return false;
+
+	freeGenomes();
+	error.clear();
+	failed = false;
+	path = file;
+	size = s.isEmpty() ? QSize(cps->width, cps->height) : s;
+	fps = qMax(1, rate);
+	format = QFileInfo(file).suffix().toLower() == "y4m" ? Y4mStream : PngFrames;
+
+	if (format == Y4mStream)
+	{
+		y4m.setFileName(path);
+		if (!y4m.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		{
+			error = tr("Couldn't open %1 for writing").arg(path);
+			return false;
+		}
+		// 4:4:4 keeps the full color resolution of the frames
+		y4m.write(QString("YUV4MPEG2 W%1 H%2 F%3:1 Ip A1:1 C444\n")
+			.arg(size.width()).arg(size.height()).arg(fps).toLatin1());
+		y4m_pending.clear();
+		y4m_next = 0;
+	}
+
+	ncps = n;
+	genomes = new flam3_genome[ncps]();
+	for (int i = 0 ; i < ncps ; i++)
+		flam3_copy(genomes + i, cps + i);
+
+	logInfo(QString("FrameExporter::start : exporting %1 frames at %2x%3 to %4")
+		.arg(ncps).arg(size.width()).arg(size.height()).arg(path));
+
+	// keep every worker busy, plus one frame ready to be dispatched.  the
+	// rendered frames waiting to be encoded are limited by the backlog.
+	int nrequests = qMax(2, r_thread->numWorkers() + 1);
+	max_backlog = qMax(nrequests, 2 * pool.maxThreadCount());
+	while (requests.size() < nrequests)
+		requests.append(new RenderRequest(0, QSize(), QString(), RenderRequest::Queued));
+
+	next_frame = 0;
+	nrendered = 0;
+	nencoded = 0;
+	idle.clear();
+	running = true;
+	timer.start();
+	foreach (RenderRequest* req, requests)
+	{
+		req->setGenome(genomes);
+		req->setNumGenomes(ncps);
+		req->setSize(size);
+		req->setImagePresets(presets);
+		renderNext(req);
+	}
+	return true;
+}
+
+/**
+ * Stop the export.  The frames that were already written are kept.
+ */
+void FrameExporter::cancel()
+{
+	if (!running)
+		return;
+
+	logInfo(QString("FrameExporter::cancel : stopping after %1 of %2 frames")
+		.arg(nencoded).arg(ncps));
+	running = false;
+	foreach (RenderRequest* req, requests)
+		r_thread->kill(req);
+	pool.waitForDone();
+	if (y4m.isOpen())
+		y4m.close();
+}
+
+bool FrameExporter::isRunning() const
+{
+	return running;
+}
+
+int FrameExporter::frames() const
+{
+	return ncps;
+}
+
+/**
+ * The file name of a frame.  The frames are numbered in the file name given
+ * to start(), and the numbers are zero padded to at least four digits.
+ */
+QString FrameExporter::framePath(int frame) const
+{
+	if (format == Y4mStream)
+		return path;
+
+	QFileInfo info(path);
+	QString suffix(info.suffix());
+	if (suffix.isEmpty())
+		suffix = "png";
+	int digits = qMax(4, QString::number(ncps - 1).size());
+	return info.dir().filePath(QString("%1%2.%3")
+		.arg(info.completeBaseName())
+		.arg(frame, digits, 10, QChar('0'))
+		.arg(suffix));
+}
+
+QString FrameExporter::errorString() const
+{
+	return error;
+}
+
+void FrameExporter::renderNext(RenderRequest* req)
+{
+	if (next_frame >= ncps)
+		return;
+	req->setTime(next_frame);
+	req->setName(tr("frame %1").arg(next_frame));
+	next_frame++;
+	r_thread->render(req);
+}
+
+void FrameExporter::flameRenderedAction(RenderEvent* e)
+{
+	RenderRequest* req = e->request();
+	if (!requests.contains(req))
+		return;
+	e->accept();
+	if (!running || !req->finished())
+		return;
+
+	int frame = (int)req->time();
+	if (req->failed())
+	{
+		logError(QString("FrameExporter::flameRenderedAction : frame %1 failed: %2")
+			.arg(frame).arg(req->error()));
+		abort(tr("Couldn't render frame %1: %2").arg(frame).arg(req->error()));
+		return;
+	}
+	logFine(QString("FrameExporter::flameRenderedAction : frame %1 rendered")
+		.arg(frame));
+	nrendered++;
+	pool.start(new EncodeFrameJob(this, frame, req->image()));
+
+	// render the next frame while this one is encoded
+	if (nrendered - nencoded < max_backlog)
+		renderNext(req);
+	else
+		idle.append(req);
+}
+
+void FrameExporter::frameEncoded(int frame, bool ok)
+{
+	if (!running)
+		return;
+
+	nencoded++;
+	if (!ok)
+	{
+		logError(QString("FrameExporter::frameEncoded : couldn't write frame %1")
+			.arg(frame));
+		error = tr("Couldn't write frame %1 to %2")
+			.arg(frame).arg(framePath(frame));
+		failed = true;
+	}
+
+	double secs = timer.elapsed() / 1000.0;
+	double rate = secs > 0.0 ? nencoded / secs : 0.0;
+	int eta = rate > 0.0 ? (int)((ncps - nencoded) / rate + 0.5) : 0;
+	emit progress(nencoded, ncps, rate, eta);
+
+	if (failed)
+		abort(error);
+	else if (nencoded == ncps)
+		finish();
+	else
+		while (!idle.isEmpty() && nrendered - nencoded < max_backlog
+				&& next_frame < ncps)
+			renderNext(idle.takeFirst());
+}
+
+/**
+ * The render thread killed its requests, so the frames in flight won't be
+ * delivered.
+ */
+void FrameExporter::renderingKilledAction()
+{
+	if (!running)
+		return;
+	logWarn("FrameExporter::renderingKilledAction : frames were killed");
+	abort(tr("The export was stopped after %1 of %2 frames")
+		.arg(nencoded).arg(ncps));
+}
+
+// Stop the export with an error.
+void FrameExporter::abort(const QString& msg)
+{
+	error = msg;
+	failed = true;
+	cancel();
+	freeGenomes();
+	emit finished(false);
+}
+
+void FrameExporter::finish()
+{
+	pool.waitForDone();
+	if (y4m.isOpen())
+		y4m.close();
+	running = false;
+	logInfo(QString("FrameExporter::finish : exported %1 frames in %2 seconds")
+		.arg(ncps).arg(timer.elapsed() / 1000.0, 0, 'f', 2));
+	freeGenomes();
+	emit finished(true);
+}
+
+void FrameExporter::freeGenomes()
+{
+	if (genomes)
+	{
+		for (int i = 0 ; i < ncps ; i++)
+			clear_cp(genomes + i, flam3_defaults_off);
+		delete[] genomes;
+		genomes = 0;
+	}
+}
+
+/**
+ * Convert a frame to BT.601 Y'CbCr planes and append it to the stream.  The
+ * frames are encoded out of order on the pool, so they're held here until
+ * every earlier frame has been written.
+ */
+bool FrameExporter::writeY4mFrame(int frame, const QImage& image)
+{
+	static const char header[] = "FRAME\n";
+	const int hsize = sizeof(header) - 1;
+	const int w = size.width();
+	const int h = size.height();
+	const int plane = w * h;
+	const QImage img(image.size() == size ? image
+		: image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+
+	QByteArray buf(hsize + 3 * plane, 0);
+	uchar* data = reinterpret_cast<uchar*>(buf.data());
+	memcpy(data, header, hsize);
+	uchar* yp = data + hsize;
+	uchar* up = yp + plane;
+	uchar* vp = up + plane;
+	for (int y = 0 ; y < h ; y++)
+	{
+		const QRgb* line = reinterpret_cast<const QRgb*>(img.scanLine(y));
+		for (int x = 0 ; x < w ; x++, yp++, up++, vp++)
+		{
+			int r = qRed(line[x]);
+			int g = qGreen(line[x]);
+			int b = qBlue(line[x]);
+			*yp = (( 66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
+			*up = ((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+			*vp = ((112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+		}
+	}
+
+	bool ok = true;
+	QMutexLocker locker(&y4m_mutex);
+	y4m_pending.insert(frame, buf);
+	while (y4m_pending.contains(y4m_next))
+	{
+		QByteArray next(y4m_pending.take(y4m_next));
+		if (y4m.write(next) != next.size())
+			ok = false;
+		y4m_next++;
+	}
+	return ok;
+}
@@ -0,0 +1,99 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef FRAMEEXPORTER_H
+#define FRAMEEXPORTER_H
+
+#include <QObject>
+#include <QFile>
+#include <QMap>
+#include <QMutex>
+#include <QThreadPool>
+#include <QTime>
+
+#include "renderthread.h"
+
+/**
+ * The FrameExporter renders every frame of a sheep loop and writes them to
+ * numbered png files, or to one YUV4MPEG2 stream when the file name ends in
+ * .y4m.  The frames are rendered as Queued requests so that several of them
+ * are rendered at once, and the rendered frames are encoded on a separate
+ * thread pool while the next frames render.  Progress is reported with the
+ * frame rate and the estimated time remaining.
+ */
+class FrameExporter : public QObject
+{
+	Q_OBJECT
+
+	friend class EncodeFrameJob;
+
+	public:
+		enum Format { PngFrames, Y4mStream };
+
+		FrameExporter(QObject* parent=0);
+		~FrameExporter();
+		bool start(const flam3_genome*, int, const QString&, const QSize&,
+			const flam3_genome&, int fps=30);
+		void cancel();
+		bool isRunning() const;
+		int frames() const;
+		QString framePath(int) const;
+		QString errorString() const;
+
+	signals:
+		void progress(int frame, int total, double fps, int eta);
+		void finished(bool);
+
+	private slots:
+		void flameRenderedAction(RenderEvent*);
+		void frameEncoded(int, bool);
+		void renderingKilledAction();
+
+	private:
+		void renderNext(RenderRequest*);
+		void finish();
+		void abort(const QString&);
+		void freeGenomes();
+		bool writeY4mFrame(int, const QImage&);
+
+		RenderThread* r_thread;
+		RenderRequestList requests;
+		RenderRequestList idle;
+		flam3_genome* genomes;
+		int ncps;
+		Format format;
+		QString path;
+		QSize size;
+		int fps;
+		int next_frame;
+		int nrendered;
+		int nencoded;
+		int max_backlog;
+		bool running;
+		bool failed;
+		QString error;
+		QThreadPool pool;
+		QFile y4m;
+		QMutex y4m_mutex;
+		QMap<int, QByteArray> y4m_pending;
+		int y4m_next;
+		QTime timer;
+};
+
+#endif // FRAMEEXPORTER_H
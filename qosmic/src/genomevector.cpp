@@ -20,12 +20,65 @@
 #include <QImage>
 #include <QPainter>
 #include <QSettings>
+#include <QDir>
+#include <QRunnable>
 
+#include "qosmic.h"
 #include "genomevector.h"
 #include "viewerpresetsmodel.h"
 #include "logger.h"
 
+// how long the selector has to be idle before its previews are written to
+// the disk cache, and how many are written between prunes of the cache
+#define PREVIEW_WRITE_DELAY 1000
+#define PREVIEW_PRUNE_INTERVAL 64
+
+/**
+ * Writes a selector preview to the disk cache on the preview pool.  A
+ * preview of a genome that has a newer preview waiting is dropped.
+ */
+class SavePreviewJob : public QRunnable
+{
+	GenomeVector* genomes;
+	RenderRequest* request;
+	int generation;
+	QString path;
+	QImage image;
+
+	public:
+		SavePreviewJob(GenomeVector* gv, RenderRequest* req, int gen,
+			const QString& p, const QImage& img)
+		: genomes(gv), request(req), generation(gen), path(p), image(img)
+		{
+		}
+
+		void run()
+		{
+			if (!genomes->previewCurrent(request, generation))
+				logFiner(QString("SavePreviewJob::run : dropping stale preview %1").arg(path));
+			else if (!QFileInfo(path).exists())
+			{
+				if (!QDir().mkpath(QOSMIC_THUMBNAILDIR) || !image.save(path, "png"))
+					logWarn(QString("SavePreviewJob::run : couldn't write %1").arg(path));
+				else
+					QMetaObject::invokeMethod(genomes, "previewSaved", Qt::QueuedConnection);
+			}
+		}
+};
+
+// Prunes the disk cache on the preview pool.
+class PrunePreviewsJob : public QRunnable
+{
+	public:
+		void run()
+		{
+			GenomeVector::pruneCachedPreviews();
+		}
+};
+
+
 GenomeVector::GenomeVector()
+: previews_saved(0)
 {
 	QSettings s;
 	s.beginGroup("genomevector");
@@ -35,10 +88,22 @@ GenomeVector::GenomeVector()
 	enable_previews = true;
 	use_previews = 0;
 	createClockPreview();
+	// one thread writes the previews and prunes the cache, in order
+	preview_pool.setMaxThreadCount(1);
+	preview_pool.start(new PrunePreviewsJob);
+	preview_timer.setSingleShot(true);
+	preview_timer.setInterval(PREVIEW_WRITE_DELAY);
+	connect(&preview_timer, SIGNAL(timeout()), this, SLOT(writePendingPreviews()));
 	r_thread = RenderThread::getInstance();
 	connect(r_thread, SIGNAL(flameRendered(RenderEvent*)), this, SLOT(flameRenderedAction(RenderEvent*)));
 }
 
+GenomeVector::~GenomeVector()
+{
+	writePendingPreviews();
+	preview_pool.waitForDone();
+}
+
 int GenomeVector::selected() const
 {
 	return selected_index;
@@ -85,6 +150,8 @@ void GenomeVector::setCapacity(int entries)
 		int count = entries * 2;
 		logInfo("GenomeVector::setCapacity : reserving %d entries", count);
 		r_thread->running_mutex.lock();
+		// reserving may move the genomes
+		r_thread->forgetGenomes(data(), size());
 		reserve(count);
 		// requeue existing requests
 		for (int n = 0 ; n < r_requests.size() ; n++)
@@ -120,6 +187,8 @@ void GenomeVector::insert(int i, int count, flam3_genome* genomes)
 	setCapacity(last);
 	flam3_genome preset = ViewerPresetsModel::getInstance()->preset(preview_preset);
 	flam3_genome* g = genomes;
+	// the genomes after the insertion point are moved
+	r_thread->forgetGenomes(data() + first, size() - first);
 	// copy the genomes into the current list.
 	for (int n = first ; n < last ; n++, g++)
 	{
@@ -142,6 +211,7 @@ void GenomeVector::insert(int i, const flam3_genome& g)
 {
 	logFine("GenomeVector::insert : inserting %d", i);
 	setCapacity(i);
+	r_thread->forgetGenomes(data() + i, size() - i);
 	QVector<flam3_genome>::insert(i, g);
 	undoRings.insert(i, UndoRing());
 	UndoState* state = undoRings[i].advance();
@@ -220,6 +290,8 @@ bool GenomeVector::remove(int i, int count)
 	{
 		logFine("GenomeVector::remove : removing rows %d to %d", i, last);
 		r_thread->running_mutex.lock();
+		// the removed genomes are freed, and the ones after them are moved
+		r_thread->forgetGenomes(data() + i, size() - i);
 		for (int n = last ; n >= i ; n--)
 		{
 			logFine("GenomeVector::remove : removing row %d", n);
@@ -516,7 +588,8 @@ void GenomeVector::updatePreviews()
 			RenderRequest* req = r_requests.at(idx);
 			flam3_genome* g = data() + idx;
 			req->setGenome(g);
-			r_thread->render(req);
+			if (!loadCachedPreview(idx))
+				r_thread->render(req);
 		}
 	}
 }
@@ -529,7 +602,8 @@ void GenomeVector::updatePreview(int idx)
 		RenderRequest* req = r_requests[idx];
 		flam3_genome* g = data() + idx;
 		req->setGenome(g);
-		r_thread->render(req);
+		if (!loadCachedPreview(idx))
+			r_thread->render(req);
 	}
 }
 
@@ -549,15 +623,15 @@ void GenomeVector::updateSelectedPreview()
 void GenomeVector::flameRenderedAction(RenderEvent* e)
 {
 	RenderRequest* req = e->request();
-	if (req->type() == RenderRequest::Queued && req->name() == "selector")
+	int idx = r_requests.indexOf(req, 0);
+	if (idx >= 0)
 	{
-		int idx = r_requests.indexOf(req, 0);
-
 		if (idx < size())
 		{
 			logFine(QString("GenomeVector::flameRenderedAction : setting genome data %1,g=0x%2,req=0x%3")
 					.arg(idx).arg((long)req->genome(),0,16).arg((long)req,0,16));
 			setData(index(idx), QPixmap::fromImage(req->image()), Qt::DecorationRole);
+			saveCachedPreview(req);
 		}
 		else
 		{
@@ -568,6 +642,91 @@ void GenomeVector::flameRenderedAction(RenderEvent* e)
 	}
 }
 
+/**
+ * The previews are cached on disk using the RenderThread's cache key, which
+ * covers the genome, the preview size, and the preview preset.
+ */
+QString GenomeVector::cachedPreviewPath(RenderRequest* req)
+{
+	return QString("%1/%2.png").arg(QOSMIC_THUMBNAILDIR)
+		.arg(QString(r_thread->cacheKey(req).toHex()));
+}
+
+bool GenomeVector::loadCachedPreview(int idx)
+{
+	QPixmap pixmap(cachedPreviewPath(r_requests[idx]));
+	if (pixmap.isNull())
+		return false;
+	logFiner("GenomeVector::loadCachedPreview : found preview %d", idx);
+	r_thread->cancel(r_requests[idx]);
+	setData(index(idx), pixmap, Qt::DecorationRole);
+	return true;
+}
+
+/**
+ * Queue a rendered preview to be written to the disk cache.  The previews
+ * are written once the selector has been idle for a moment, so only the
+ * last preview of each genome is written while it's being edited.
+ */
+void GenomeVector::saveCachedPreview(RenderRequest* req)
+{
+	// the genome may have been edited since the image was rendered, so the
+	// key taken when it was dispatched is used
+	if (req->key().isEmpty())
+		return;
+	PendingPreview p;
+	p.key = req->key();
+	p.image = req->image();
+	QMutexLocker locker(&preview_mutex);
+	p.generation = ++preview_generations[req];
+	pending_previews.insert(req, p);
+	locker.unlock();
+	preview_timer.start();
+}
+
+void GenomeVector::writePendingPreviews()
+{
+	QMap<RenderRequest*, PendingPreview> pending(pending_previews);
+	pending_previews.clear();
+	QMap<RenderRequest*, PendingPreview>::const_iterator i;
+	for (i = pending.constBegin() ; i != pending.constEnd() ; ++i)
+	{
+		QString path(QString("%1/%2.png").arg(QOSMIC_THUMBNAILDIR)
+			.arg(QString(i.value().key.toHex())));
+		preview_pool.start(new SavePreviewJob(this, i.key(),
+			i.value().generation, path, i.value().image));
+	}
+}
+
+// Called from the preview pool.
+bool GenomeVector::previewCurrent(RenderRequest* req, int generation)
+{
+	QMutexLocker locker(&preview_mutex);
+	return preview_generations.value(req) == generation;
+}
+
+void GenomeVector::previewSaved()
+{
+	if (++previews_saved % PREVIEW_PRUNE_INTERVAL == 0)
+		preview_pool.start(new PrunePreviewsJob);
+}
+
+/**
+ * Remove the oldest cached previews once there are too many of them.  This
+ * runs on the preview pool.
+ */
+void GenomeVector::pruneCachedPreviews()
+{
+	static const int max_previews = 8192;
+	QFileInfoList files = QDir(QOSMIC_THUMBNAILDIR).entryInfoList(
+		QStringList("*.png"), QDir::Files, QDir::Time | QDir::Reversed);
+	int count = files.size() - max_previews;
+	if (count > 0)
+		logInfo("GenomeVector::pruneCachedPreviews : removing %d previews", count);
+	for (int n = 0 ; n < count ; n++)
+		QFile::remove(files.at(n).absoluteFilePath());
+}
+
 void GenomeVector::createClockPreview()
 {
 	logFine("GenomeVector::createClockPreview : enter");
@@ -22,6 +22,9 @@
 
 #include <QVector>
 #include <QAbstractListModel>
+#include <QThreadPool>
+#include <QTimer>
+#include <QMutex>
 
 #include "flam3util.h"
 #include "undoring.h"
@@ -31,6 +34,8 @@ class GenomeVector : public QAbstractListModel, public QVector<flam3_genome>
 {
 	Q_OBJECT
 
+	friend class SavePreviewJob;
+
 	public:
 		enum AutoSave { NeverSave = 0, SaveOnExit = 1, AlwaysSave = 2 };
 
@@ -48,8 +53,24 @@ class GenomeVector : public QAbstractListModel, public QVector<flam3_genome>
 		QPixmap clock_preview;
 		AutoSave auto_save;
 
+		// a preview waiting to be written to the disk cache
+		struct PendingPreview
+		{
+			QByteArray key;
+			QImage image;
+			int generation;
+		};
+
+		QThreadPool preview_pool;
+		QTimer preview_timer;
+		QMap<RenderRequest*, PendingPreview> pending_previews;
+		QMutex preview_mutex;
+		QHash<RenderRequest*, int> preview_generations;
+		int previews_saved;
+
 	public:
 		GenomeVector();
+		~GenomeVector();
 		void setSelected(int value);
 		int selected() const;
 		QModelIndex selectedIndex() const;
@@ -108,9 +129,18 @@ class GenomeVector : public QAbstractListModel, public QVector<flam3_genome>
 		void clearPreviews();
 		void clearPreview(int);
 
+	private slots:
+		void writePendingPreviews();
+		void previewSaved();
+
 	private:
 		void setCapacity(int entries);
 		void createClockPreview();
+		QString cachedPreviewPath(RenderRequest*);
+		bool loadCachedPreview(int);
+		void saveCachedPreview(RenderRequest*);
+		bool previewCurrent(RenderRequest*, int);
+		static void pruneCachedPreviews();
 };
 
 
@@ -19,27 +19,157 @@
  ***************************************************************************/
 
 #include <QIcon>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QStack>
 
 #include "gradientlistmodel.h"
 
+// the number of table swatches to keep around as pixmaps
+#define SWATCH_CACHE_SIZE 128
+
+/**
+ * Draws swatches for the rows of a palette table.  The most recently
+ * requested rows are drawn first, since those are the rows being shown.
+ */
+class SwatchRenderer : public QThread
+{
+	GradientListModel* model;
+	QVector<QRgb> table;
+	QSize size;
+	QStack<int> rows;
+	QMutex mutex;
+	QWaitCondition wait_cond;
+	bool running;
+
+	public:
+		SwatchRenderer(GradientListModel* m, const QVector<QRgb>& t, const QSize& s)
+		: model(m), table(t), size(s), running(true)
+		{
+		}
+
+		void request(int row)
+		{
+			QMutexLocker locker(&mutex);
+			rows.push(row);
+			wait_cond.wakeOne();
+		}
+
+		void stop()
+		{
+			mutex.lock();
+			running = false;
+			wait_cond.wakeOne();
+			mutex.unlock();
+			wait();
+		}
+
+		void run()
+		{
+			QMutexLocker locker(&mutex);
+			while (running)
+			{
+				if (rows.isEmpty())
+				{
+					wait_cond.wait(&mutex);
+					continue;
+				}
+				int row = rows.pop();
+				locker.unlock();
+
+				QImage image(size, QImage::Format_RGB32);
+				const QRgb* colors = table.constData() + row * 256;
+				QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(0));
+				for (int x = 0 ; x < size.width() ; x++)
+					line[x] = colors[qMin(255, x * 256 / size.width())];
+				for (int y = 1 ; y < size.height() ; y++)
+					memcpy(image.scanLine(y), line, size.width() * sizeof(QRgb));
+				QMetaObject::invokeMethod(model, "swatchRendered",
+					Qt::QueuedConnection, Q_ARG(int, row), Q_ARG(QImage, image));
+
+				locker.relock();
+			}
+		}
+};
+
+
 GradientListModel::GradientListModel(QObject *parent)
-	: QAbstractListModel(parent)
+	: QAbstractListModel(parent), swatches(SWATCH_CACHE_SIZE), renderer(0)
 {
 }
 
+GradientListModel::~GradientListModel()
+{
+	if (renderer)
+	{
+		renderer->stop();
+		delete renderer;
+	}
+}
+
 QVariant GradientListModel::data(const QModelIndex &index, int role) const
 {
 	if (!index.isValid())
 		return QVariant();
 
 	if (role == Qt::DecorationRole)
-		return QIcon(pixmaps.value(index.row()));
+		return QIcon(swatch(index.row()));
 	else if (role == Qt::UserRole)
-		return pixmaps.value(index.row());
+		return swatch(index.row());
 
 	return QVariant();
 }
 
+QPixmap GradientListModel::swatch(int row) const
+{
+	if (paletteTable.isEmpty())
+		return pixmaps.value(row);
+
+	if (swatches.contains(row))
+		return *swatches.object(row);
+
+	if (!pending.contains(row))
+	{
+		pending.insert(row);
+		renderer->request(row);
+	}
+	return placeholder;
+}
+
+void GradientListModel::swatchRendered(int row, const QImage& image)
+{
+	if (!pending.remove(row))
+		return;
+	swatches.insert(row, new QPixmap(QPixmap::fromImage(image)));
+	QModelIndex idx(index(row));
+	emit dataChanged(idx, idx);
+}
+
+/**
+ * Use a packed table of palettes, 256 colors per palette, instead of the
+ * added pixmaps.  Each swatch is drawn at the given size when it is first
+ * shown.
+ */
+void GradientListModel::setPaletteTable(const QVector<QRgb>& table, const QSize& size)
+{
+	beginResetModel();
+	if (renderer)
+	{
+		renderer->stop();
+		delete renderer;
+	}
+	paletteTable = table;
+	swatchSize = size;
+	swatches.clear();
+	pending.clear();
+	placeholder = QPixmap(size);
+	placeholder.fill(Qt::lightGray);
+	renderer = new SwatchRenderer(this, table, size);
+	renderer->start(QThread::LowPriority);
+	endResetModel();
+}
+
 void GradientListModel::addGradient(const QPixmap &pixmap)
 {
 	int row = pixmaps.size();
@@ -83,6 +213,8 @@ int GradientListModel::rowCount(const QModelIndex &parent) const
 {
 	if (parent.isValid())
 		return 0;
+	else if (!paletteTable.isEmpty())
+		return paletteTable.size() / 256;
 	else
 		return pixmaps.size();
 }
@@ -24,23 +24,47 @@
 #include <QAbstractListModel>
 #include <QList>
 #include <QPixmap>
+#include <QCache>
+#include <QSet>
+#include <QVector>
 
+class SwatchRenderer;
+
+/**
+ * A list of gradient swatches.  Swatches can be added as pixmaps, or the
+ * model can be given a packed table of palettes with 256 colors each.  The
+ * swatches for a table are only drawn when a view asks for them.  They are
+ * drawn on a background thread and kept in a small cache.
+ */
 class GradientListModel : public QAbstractListModel
 {
 		Q_OBJECT
 
 	public:
 		GradientListModel ( QObject *parent = 0 );
+		~GradientListModel();
 
 		QVariant data ( const QModelIndex &index, int role = Qt::DisplayRole ) const;
 		Qt::ItemFlags flags ( const QModelIndex &index ) const;
 		bool removeRows ( int row, int count, const QModelIndex &parent=QModelIndex() );
 		int rowCount ( const QModelIndex &parent ) const;
 		void addGradient ( const QPixmap &pixmap );
+		void setPaletteTable ( const QVector<QRgb> &table, const QSize &size );
 		void clear();
 
+	private slots:
+		void swatchRendered ( int row, const QImage &image );
+
 	private:
+		QPixmap swatch ( int row ) const;
+
 		QList<QPixmap> pixmaps;
+		QVector<QRgb> paletteTable;
+		QSize swatchSize;
+		QPixmap placeholder;
+		mutable QCache<int, QPixmap> swatches;
+		mutable QSet<int> pending;
+		SwatchRenderer* renderer;
 };
 
 
@@ -0,0 +1,200 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <QVector>
+
+#include "imageconvert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QOSMIC_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace Util
+{
+
+typedef void (*row_converter)(const unsigned char*, QRgb*, int);
+
+static void rgb_row_scalar(const unsigned char* in, QRgb* out, int n)
+{
+	for (int i = 0 ; i < n ; i++, in += 3)
+		out[i] = qRgb(in[0], in[1], in[2]);
+}
+
+static void rgba_row_scalar(const unsigned char* in, QRgb* out, int n)
+{
+	for (int i = 0 ; i < n ; i++, in += 4)
+		out[i] = qRgba(in[0], in[1], in[2], in[3]);
+}
+
+#ifdef QOSMIC_X86_SIMD
+
+// The input bytes are r,g,b[,a] and a QRgb is stored as b,g,r,a on x86.
+
+__attribute__((target("ssse3")))
+static void rgb_row_ssse3(const unsigned char* in, QRgb* out, int n)
+{
+	const __m128i mask = _mm_setr_epi8(
+		2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m128i alpha = _mm_set1_epi32(0xff000000);
+	int i = 0;
+	// each load reads 16 bytes but only uses the first 12
+	for ( ; i + 6 <= n ; i += 4, in += 12)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)in);
+		x = _mm_or_si128(_mm_shuffle_epi8(x, mask), alpha);
+		_mm_storeu_si128((__m128i*)(out + i), x);
+	}
+	rgb_row_scalar(in, out + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void rgba_row_sse2(const unsigned char* in, QRgb* out, int n)
+{
+	const __m128i ag_mask = _mm_set1_epi32(0xff00ff00);
+	const __m128i rb_mask = _mm_set1_epi32(0x00ff00ff);
+	int i = 0;
+	for ( ; i + 4 <= n ; i += 4, in += 16)
+	{
+		__m128i x  = _mm_loadu_si128((const __m128i*)in);
+		__m128i ag = _mm_and_si128(x, ag_mask);
+		__m128i rb = _mm_and_si128(x, rb_mask);
+		rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(ag, rb));
+	}
+	rgba_row_scalar(in, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void rgb_row_avx2(const unsigned char* in, QRgb* out, int n)
+{
+	const __m256i mask = _mm256_setr_epi8(
+		2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+		2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m256i alpha = _mm256_set1_epi32(0xff000000);
+	int i = 0;
+	// four pixels per lane, the second lane reads 16 bytes at offset 12
+	for ( ; i + 10 <= n ; i += 8, in += 24)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i*)in);
+		__m128i hi = _mm_loadu_si128((const __m128i*)(in + 12));
+		__m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		x = _mm256_or_si256(_mm256_shuffle_epi8(x, mask), alpha);
+		_mm256_storeu_si256((__m256i*)(out + i), x);
+	}
+	rgb_row_scalar(in, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void rgba_row_avx2(const unsigned char* in, QRgb* out, int n)
+{
+	const __m256i mask = _mm256_setr_epi8(
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	int i = 0;
+	for ( ; i + 8 <= n ; i += 8, in += 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)in);
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_shuffle_epi8(x, mask));
+	}
+	rgba_row_scalar(in, out + i, n - i);
+}
+
+#endif // QOSMIC_X86_SIMD
+
+struct RowConverters
+{
+	row_converter rgb;
+	row_converter rgba;
+	const char* name;
+
+	RowConverters(row_converter c3 = &rgb_row_scalar,
+		row_converter c4 = &rgba_row_scalar, const char* n = "scalar")
+	: rgb(c3), rgba(c4), name(n)
+	{
+	}
+};
+
+// every set of kernels this cpu can run, from the slowest to the fastest
+static QVector<RowConverters> supported_converters()
+{
+	QVector<RowConverters> list;
+	list << RowConverters();
+#ifdef QOSMIC_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		list << RowConverters(&rgb_row_scalar, &rgba_row_sse2, "sse2");
+	if (__builtin_cpu_supports("ssse3"))
+		list << RowConverters(&rgb_row_ssse3, &rgba_row_sse2, "ssse3");
+	if (__builtin_cpu_supports("avx2"))
+		list << RowConverters(&rgb_row_avx2, &rgba_row_avx2, "avx2");
+#endif
+	return list;
+}
+
+// selected once, the render workers may call this concurrently
+static const QVector<RowConverters>& all_converters()
+{
+	static const QVector<RowConverters> converters(supported_converters());
+	return converters;
+}
+
+static const RowConverters& row_converters()
+{
+	return all_converters().last();
+}
+
+static void convert_image(const RowConverters& rc, const unsigned char* in,
+	int channels, QImage& img)
+{
+	row_converter convert_row = channels == 3 ? rc.rgb : rc.rgba;
+	const int width  = img.width();
+	const int height = img.height();
+	const int stride = channels * width;
+	for (int h = 0 ; h < height ; h++, in += stride)
+		convert_row(in, reinterpret_cast<QRgb*>(img.scanLine(h)), width);
+}
+
+void convert_image(const unsigned char* in, int channels, QImage& img)
+{
+	convert_image(row_converters(), in, channels, img);
+}
+
+const char* convert_image_kernel()
+{
+	return row_converters().name;
+}
+
+int convert_image_kernel_count()
+{
+	return all_converters().size();
+}
+
+const char* convert_image_kernel_name(int kernel)
+{
+	return all_converters().at(kernel).name;
+}
+
+void convert_image_with(int kernel, const unsigned char* in, int channels, QImage& img)
+{
+	convert_image(all_converters().at(kernel), in, channels, img);
+}
+
+}
@@ -0,0 +1,50 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef IMAGECONVERT_H
+#define IMAGECONVERT_H
+
+#include <QImage>
+
+namespace Util
+{
+	/**
+	 * Copy a packed flam3_render() output buffer into an image of the same
+	 * size.  Three channel (RGB) buffers are written to a Format_RGB32 image,
+	 * and four channel (RGBA) buffers to a Format_ARGB32 image.  The rows are
+	 * converted with SSE2/SSSE3 or AVX2 kernels when the cpu supports them.
+	 */
+	void convert_image(const unsigned char* in, int channels, QImage& img);
+
+	/**
+	 * The name of the conversion kernels selected for this cpu.
+	 */
+	const char* convert_image_kernel();
+
+	/**
+	 * The kernels this cpu can run, from the scalar one at zero to the one
+	 * convert_image() uses.  These are for benchmarking the kernels.
+	 */
+	int convert_image_kernel_count();
+	const char* convert_image_kernel_name(int);
+	void convert_image_with(int, const unsigned char*, int, QImage&);
+}
+
+#endif // IMAGECONVERT_H
@@ -20,243 +20,326 @@
 #include <QThread>
 #include <QMutexLocker>
 #include <cstdarg>
+#include <cstdlib>
 
 #include "logger.h"
 
 QTextStream cout(stdout);
 QTextStream cerr(stdout);
 
+// the writer thread wakes at least this often to write new messages
+#define LOGWRITER_INTERVAL 50
+
 namespace Util
 {
 
+static volatile bool log_exiting = false;
+
+/**
+ * Writes out the messages posted to the Logger, and flushes the stream once
+ * for each batch.
+ */
+class LogWriter : public QThread
+{
+	Logger* log;
+
+	public:
+		LogWriter(Logger* l) : log(l) {}
+
+		void run()
+		{
+			while (!log_exiting)
+			{
+				QMutexLocker locker(&log->m_mutex);
+				log->m_wait.wait(&log->m_mutex, LOGWRITER_INTERVAL);
+				if (log->drain())
+					log->m_stream->flush();
+			}
+		}
+
+		// stop the writer and write out what's left at exit
+		static void finish()
+		{
+			Logger* log = Logger::m_self;
+			log_exiting = true;
+			log->m_wait.wakeAll();
+			log->m_writer->wait();
+			log->flush();
+		}
+};
+
+static void flush_at_exit()
+{
+	LogWriter::finish();
+}
+
 Logger* Logger::m_self = 0;// initialize pointer
 
+static const char* level_names[] =
+	{ "critical", "error", "none", "warn", "info", "fine", "finer", "finest" };
+
 Logger::Logger()
 {
 	m_stream = &cout;
-	m_level = INFO;
+	init();
 }
 
 Logger::Logger(QTextStream& out)
 {
 	m_stream = &out;
+	init();
+}
+
+void Logger::init()
+{
 	m_level = INFO;
+	m_ring = new Entry[RingSize];
+	for (int n = 0 ; n < RingSize ; n++)
+		m_ring[n].seq = n;
+	m_head = 0;
+	m_tail = 0;
+	m_writer = 0;
 }
 
 Logger* Logger::getInstance()
 {
 	if (m_self == 0)
-		m_self = new Logger(cout);
+	{
+		// the logger writes with its own stream so that it doesn't share
+		// the cout buffer with other threads.
+		static QTextStream out(stdout);
+		m_self = new Logger(out);
+		m_self->m_writer = new LogWriter(m_self);
+		m_self->m_writer->start(QThread::LowPriority);
+		atexit(flush_at_exit);
+	}
 	return m_self;
 }
 
+/**
+ * Add a message to the ring buffer.  Each producer claims a slot by
+ * advancing m_head, and then marks the slot as filled.  If the buffer is
+ * full, the producer waits for the writer to catch up.
+ */
+void Logger::post(int level, const QString& msg)
+{
+	Entry* e;
+	forever
+	{
+		int pos = m_head.load();
+		e = m_ring + (pos & (RingSize - 1));
+		int dif = (int)((unsigned)e->seq.loadAcquire() - (unsigned)pos);
+		if (dif == 0)
+		{
+			if (m_head.testAndSetRelaxed(pos, pos + 1))
+			{
+				e->level = level;
+				e->tid = QThread::currentThreadId();
+				e->msg = msg;
+				e->seq.storeRelease(pos + 1);
+				break;
+			}
+		}
+		else if (dif < 0)
+		{
+			m_wait.wakeOne();
+			QThread::yieldCurrentThread();
+		}
+	}
+	if (level <= WARN)
+		m_wait.wakeOne();
+}
+
+/**
+ * Write every filled slot to the stream.  The caller must hold m_mutex.
+ * Returns true if anything was written.
+ */
+bool Logger::drain()
+{
+	bool wrote = false;
+	forever
+	{
+		Entry* e = m_ring + (m_tail & (RingSize - 1));
+		if (e->seq.loadAcquire() != m_tail + 1)
+			break;
+		*m_stream << level_names[e->level] << " [" << (long)e->tid << "]: "
+			<< e->msg << '\n';
+		e->msg.clear();
+		e->seq.storeRelease(m_tail + RingSize);
+		m_tail++;
+		wrote = true;
+	}
+	return wrote;
+}
+
+/**
+ * Write out any waiting messages before returning.
+ */
+void Logger::flush()
+{
+	QMutexLocker locker(&m_mutex);
+	drain();
+	m_stream->flush();
+}
+
 void Logger::info(QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= INFO)
-	*m_stream << QString("info [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= INFO)
+		post(INFO, msg);
 }
 
 void Logger::warn(QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= WARN)
-	*m_stream << QString("warn [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= WARN)
+		post(WARN, msg);
 }
 
 void Logger::error(QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= ERROR)
-	*m_stream << QString("error [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= ERROR)
+		post(ERROR, msg);
 }
 
 void Logger::critical(QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= CRITICAL)
-	*m_stream << QString("critical [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= CRITICAL)
+		post(CRITICAL, msg);
 }
 
 void Logger::fine(QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= FINE)
-	*m_stream << QString("fine [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= FINE)
+		post(FINE, msg);
 }
 
 void Logger::finer(QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= FINER)
-	*m_stream << QString("finer [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= FINER)
+		post(FINER, msg);
 }
 
 void Logger::finest(QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= FINEST)
-	*m_stream << QString("finest [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= FINEST)
+		post(FINEST, msg);
 }
 
 void Logger::info(const QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= INFO)
-	*m_stream << QString("info [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= INFO)
+		post(INFO, msg);
 }
 
 void Logger::warn(const QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= WARN)
-	*m_stream << QString("warn [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= WARN)
+		post(WARN, msg);
 }
 
 void Logger::error(const QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= ERROR)
-	*m_stream << QString("error [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= ERROR)
+		post(ERROR, msg);
 }
 
 void Logger::critical(const QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= CRITICAL)
-	*m_stream << QString("critical [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= CRITICAL)
+		post(CRITICAL, msg);
 }
 
 void Logger::fine(const QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= FINE)
-	*m_stream << QString("fine [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= FINE)
+		post(FINE, msg);
 }
 
 void Logger::finer(const QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= FINER)
-	*m_stream << QString("finer [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= FINER)
+		post(FINER, msg);
 }
 
 void Logger::finest(const QString& msg)
 {
-  QMutexLocker locker(&m_mutex);
-  if(m_level >= FINEST)
-	*m_stream << QString("finest [%1]: ").
-	  arg((long) QThread::currentThreadId()) << msg << endl;
+	if (m_level >= FINEST)
+		post(FINEST, msg);
 }
 
 
 void Logger::info(const char* msg, ...)
 {
-	QMutexLocker locker(&m_mutex);
-	if(m_level >= INFO)
+	if (m_level >= INFO)
 	{
 		va_list ap;
 		va_start(ap, msg);
-		*m_stream << QString("info [%1]: ").arg((long)QThread::currentThreadId())
-				  << QString().vsprintf(msg, ap)
-				  << endl;
+		post(INFO, QString().vsprintf(msg, ap));
 		va_end(ap);
 	}
 }
 
 void Logger::warn(const char* msg, ...)
 {
-	QMutexLocker locker(&m_mutex);
-	if(m_level >= WARN)
+	if (m_level >= WARN)
 	{
 		va_list ap;
 		va_start(ap, msg);
-		*m_stream << QString("warn [%1]: ").arg((long)QThread::currentThreadId())
-				  << QString().vsprintf(msg, ap)
-				  << endl;
+		post(WARN, QString().vsprintf(msg, ap));
 		va_end(ap);
 	}
 }
 
 void Logger::error(const char* msg, ...)
 {
-	QMutexLocker locker(&m_mutex);
-	if(m_level >= ERROR)
+	if (m_level >= ERROR)
 	{
 		va_list ap;
 		va_start(ap, msg);
-		*m_stream << QString("error [%1]: ").arg((long)QThread::currentThreadId())
-				  << QString().vsprintf(msg, ap)
-				  << endl;
+		post(ERROR, QString().vsprintf(msg, ap));
 		va_end(ap);
 	}
 }
 
 void Logger::critical(const char* msg, ...)
 {
-	QMutexLocker locker(&m_mutex);
-	if(m_level >= CRITICAL)
+	if (m_level >= CRITICAL)
 	{
 		va_list ap;
 		va_start(ap, msg);
-		*m_stream << QString("critical [%1]: ").arg((long)QThread::currentThreadId())
-				  << QString().vsprintf(msg, ap)
-				  << endl;
+		post(CRITICAL, QString().vsprintf(msg, ap));
 		va_end(ap);
 	}
 }
 
 void Logger::fine(const char* msg, ...)
 {
-	QMutexLocker locker(&m_mutex);
-	if(m_level >= FINE)
+	if (m_level >= FINE)
 	{
 		va_list ap;
 		va_start(ap, msg);
-		*m_stream << QString("fine [%1]: ").arg((long)QThread::currentThreadId())
-				  << QString().vsprintf(msg, ap)
-				  << endl;
+		post(FINE, QString().vsprintf(msg, ap));
 		va_end(ap);
 	}
 }
 
 void Logger::finer(const char* msg, ...)
 {
-	QMutexLocker locker(&m_mutex);
-	if(m_level >= FINER)
+	if (m_level >= FINER)
 	{
 		va_list ap;
 		va_start(ap, msg);
-		*m_stream << QString("finer [%1]: ").arg((long)QThread::currentThreadId())
-				  << QString().vsprintf(msg, ap)
-				  << endl;
+		post(FINER, QString().vsprintf(msg, ap));
 		va_end(ap);
 	}
 }
 
 void Logger::finest(const char* msg, ...)
 {
-	QMutexLocker locker(&m_mutex);
-	if(m_level >= FINEST)
+	if (m_level >= FINEST)
 	{
 		va_list ap;
 		va_start(ap, msg);
-		*m_stream << QString("finest [%1]: ").arg((long)QThread::currentThreadId())
-				  << QString().vsprintf(msg, ap)
-				  << endl;
+		post(FINEST, QString().vsprintf(msg, ap));
 		va_end(ap);
 	}
 }
@@ -274,6 +357,7 @@ int Logger::level()
 
 Logger::~Logger()
 {
+	flush();
 }
 
 int Logger::levelFor(char* c)
@@ -21,6 +21,8 @@
 #define INCLUDE_LOGGER_H
 
 #include <QMutex>
+#include <QWaitCondition>
+#include <QAtomicInt>
 #include <QTextStream>
 
 // undef these tokens to avoid conflicts with other
@@ -40,13 +42,42 @@ extern QTextStream cerr;
 
 namespace Util
 {
+class LogWriter;
+
+/**
+ * Messages are posted to a fixed size ring buffer without taking a lock,
+ * and a background thread writes them out in batches.  The log macros check
+ * the level before their arguments are evaluated, so disabled messages are
+ * never formatted.
+ */
 class Logger
 {
+	friend class LogWriter;
+
+	static const int RingSize = 4096; // must be a power of two
+
+	struct Entry
+	{
+		QAtomicInt seq;
+		int level;
+		Qt::HANDLE tid;
+		QString msg;
+	};
+
 	private:
 		static Logger* m_self;
 		int m_level;
 		QTextStream* m_stream;
+		Entry* m_ring;
+		QAtomicInt m_head;
+		int m_tail;
 		QMutex m_mutex;
+		QWaitCondition m_wait;
+		LogWriter* m_writer;
+
+		void init();
+		void post(int, const QString&);
+		bool drain();
 
 	protected:
 		Logger();
@@ -59,6 +90,8 @@ class Logger
 		void logMessage(const QString&);
 		void setLevel(int);
 		int level();
+		bool enabled(int l) const { return m_level >= l; }
+		void flush();
 
 		void info(QString&);
 		void warn(QString&);
@@ -99,16 +132,23 @@ class Logger
 
 #define toNum(n) QString::number(n)
 
-#define logCrit(...) Util::Logger::getInstance()->critical(__VA_ARGS__)
-#define logError(...) Util::Logger::getInstance()->error(__VA_ARGS__)
-#define logWarn(...) Util::Logger::getInstance()->warn(__VA_ARGS__)
+// check the level before the message arguments are evaluated
+#define logAt(lvl, func, ...) do { \
+	Util::Logger* logger_ = Util::Logger::getInstance(); \
+	if (logger_->enabled(Util::Logger::lvl)) \
+		logger_->func(__VA_ARGS__); \
+	} while (0)
+
+#define logCrit(...) logAt(CRITICAL, critical, __VA_ARGS__)
+#define logError(...) logAt(ERROR, error, __VA_ARGS__)
+#define logWarn(...) logAt(WARN, warn, __VA_ARGS__)
 
 #ifdef LOGGING
 
-#define logInfo(...) Util::Logger::getInstance()->info(__VA_ARGS__)
-#define logFine(...) Util::Logger::getInstance()->fine(__VA_ARGS__)
-#define logFiner(...) Util::Logger::getInstance()->finer(__VA_ARGS__)
-#define logFinest(...) Util::Logger::getInstance()->finest(__VA_ARGS__)
+#define logInfo(...) logAt(INFO, info, __VA_ARGS__)
+#define logFine(...) logAt(FINE, fine, __VA_ARGS__)
+#define logFiner(...) logAt(FINER, finer, __VA_ARGS__)
+#define logFinest(...) logAt(FINEST, finest, __VA_ARGS__)
 
 #else
 
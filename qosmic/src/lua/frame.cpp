@@ -19,6 +19,7 @@
  ***************************************************************************/
 #include "frame.h"
 #include "genome.h"
+#include "renderhandle.h"
 #include "luathreadadapter.h"
 
 #define method(name) {#name, &Frame::name}
@@ -33,6 +34,8 @@ Lunar<Frame>::RegType Frame::methods[] =
 	method(bitdepth),
 	method(earlyclip),
 	method(render),
+	method(render_async),
+	method(wait_all),
 	method(update),
 	method(num_genomes),
 	method(load),
@@ -147,6 +150,44 @@ int Frame::render(lua_State* L)
 	return 1;
 }
 
+// render a genome to a png file without blocking, and return a RenderHandle
+// that can wait for it.
+int Frame::render_async(lua_State* L)
+{
+	if (lua_gettop(L) != 2)
+		return luaL_error(L, "render_async requires a genome and a file name", "");
+
+	flam3_genome* g;
+	if (lua_isuserdata(L, 1) == 1)
+		g = Lunar<Genome>::check(L, 1)->get_genome_ptr(L);
+	else
+	{
+		int idx = qMax(0, luaL_checkint(L, 1) - 1);
+		if (idx >= genome_vec->size())
+			return luaL_error(L, "index out of range: Genome[%d] is null", idx + 1);
+		g = genome_vec->data() + idx;
+	}
+	const char* fname = luaL_checkstring(L, 2);
+	int id = m_adapter->renderAsync(g, QString(fname));
+
+	lua_settop(L, 0);
+	luaL_getmetatable(L, RenderHandle::className);
+	Lunar<RenderHandle>::new_T(L);
+	Lunar<RenderHandle>::check(L, 1)->setId(id);
+	return 1;
+}
+
+// block until every render_async() image is saved
+int Frame::wait_all(lua_State* L)
+{
+	bool saved = m_adapter->waitAllRenders();
+	lua_settop(L, 0);
+	if (m_adapter->thread()->stopping())
+		return luaL_error(L, "stopping", "");
+	lua_pushboolean(L, saved);
+	return 1;
+}
+
 // the same as render(), but it calls m_adapter->update() instead
 int Frame::update(lua_State* L)
 {
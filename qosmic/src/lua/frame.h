@@ -43,6 +43,8 @@ class Frame : public LuaType
 		int num_genomes(lua_State*);
 		int update(lua_State*);
 		int render(lua_State*);
+		int render_async(lua_State*);
+		int wait_all(lua_State*);
 		int load(lua_State*);
 		int save(lua_State*);
 		int copy_genome(lua_State*);
@@ -23,6 +23,7 @@
 #include "luathread.h"
 #include "genome.h"
 #include "xform.h"
+#include "renderhandle.h"
 #include "qosmic.h"
 #include "mainwindow.h"
 #include "luathreadadapter.h"
@@ -35,7 +36,7 @@ LuaThread::LuaThread(MainWindow* m, QObject* parent)
 	lua_paths.append(QOSMIC_SCRIPTSDIR + "/?.lua");
 	lua_paths.append(";" + QOSMIC_USERDIR  + "/scripts/?.lua");
 	thread_adapter = new LuaThreadAdapter(m, this);
-	irandinit(&ctx, 0);
+	Util::init_randctx(&ctx, Util::next_stream());
 }
 
 LuaThread::~LuaThread()
@@ -77,6 +78,7 @@ void LuaThread::run()
 		lua_error = tr("ok");
 
 	lua_close(L);
+	thread_adapter->finishRenders();
 	thread_adapter->window()->setDialogsEnabled(true);
 
 	// signal the genomevector watchers of updates made with Lua calls
@@ -213,6 +215,7 @@ void LuaThread::lua_load_environment(lua_State* L)
 	Lunar<Frame>::Register(L);
 	Lunar<Genome>::Register(L);
 	Lunar<XForm>::Register(L);
+	Lunar<RenderHandle>::Register(L);
 
 	/* registry["thread_adapter"] = &thread_adapter */
 	lua_pushlightuserdata(L, (void*)&LuaThreadAdapter::RegKey);  /* push address */
@@ -25,16 +25,22 @@
 const char Lua::LuaThreadAdapter::RegKey = 'k';
 
 Lua::LuaThreadAdapter::LuaThreadAdapter(MainWindow* mw, LuaThread* t, QObject* parent)
- : QObject(parent), m_win(mw), m_thread(t)
+ : QObject(parent), m_win(mw), m_thread(t), m_wait_request(0),
+   m_wait_done(false), m_interrupts(0), m_kills(0), m_next_id(0),
+   m_releaser(new AsyncRenderReleaser())
 {
 	logFine("Lua::LuaThreadAdapter::LuaThreadAdapter : const");
 	moveToThread(t);
+	// The lua thread blocks on m_rendered while it waits for an image, so
+	// these slots are called directly from the signaling threads.
 	connect(m_win, SIGNAL(mainWindowChanged()),
-			this, SLOT(mainWindowChangedSlot()), Qt::QueuedConnection);
+			this, SLOT(mainWindowChangedSlot()), Qt::DirectConnection);
 	connect(m_win->renderThread(), SIGNAL(flameRendered(RenderEvent*)),
-			this, SLOT(flameRenderedSlot(RenderEvent*)), Qt::QueuedConnection);
+			this, SLOT(flameRenderedSlot(RenderEvent*)), Qt::DirectConnection);
+	connect(m_win->renderThread(), SIGNAL(flameRenderingKilled()),
+			this, SLOT(flameRenderingKilledSlot()), Qt::DirectConnection);
 	connect(m_thread, SIGNAL(scriptStopped()),
-			this, SLOT(mainWindowChangedSlot()), Qt::QueuedConnection);
+			this, SLOT(mainWindowChangedSlot()), Qt::DirectConnection);
 	connect(this, SIGNAL(updateSignal()), m_win->xformEditor(),
 			SLOT(reset()),  Qt::QueuedConnection);
 }
@@ -45,12 +51,17 @@ Lua::LuaThreadAdapter::~LuaThreadAdapter()
 	logFine("Lua::LuaThreadAdapter::LuaThreadAdapter : dest");
 	disconnect(m_win->renderThread(), SIGNAL(flameRendered(RenderEvent*)),
 			   this, SLOT(flameRenderedSlot(RenderEvent*)));
+	disconnect(m_win->renderThread(), SIGNAL(flameRenderingKilled()),
+			   this, SLOT(flameRenderingKilledSlot()));
 	disconnect(m_win, SIGNAL(mainWindowChanged()),
 			   this, SLOT(mainWindowChangedSlot()));
 	disconnect(m_thread, SIGNAL(scriptStopped()),
 			   this, SLOT(mainWindowChangedSlot()));
 	disconnect(this, SIGNAL(updateSignal()),
 			   m_win->xformEditor(), SLOT(reset()));
+	finishRenders();
+	// the releaser frees the renders it holds before it's deleted
+	m_releaser->deleteLater();
 }
 
 
@@ -67,8 +78,9 @@ BasisTriangle* Lua::LuaThreadAdapter::basisTriangle()
 void Lua::LuaThreadAdapter::renderPreview(int idx)
 {
 	logFine("Lua::LuaThreadAdapter::renderPreview");
-	m_win->renderPreview(idx);
-	waitForEvent();
+	waitForRequest(m_win->previewRequest(), false);
+	if (m_win->renderPreview(idx))
+		waitForRequest(m_win->previewRequest(), true);
 }
 
 void Lua::LuaThreadAdapter::update(int idx)
@@ -105,42 +117,236 @@ bool Lua::LuaThreadAdapter::saveFile(const QString& name)
 bool Lua::LuaThreadAdapter::saveImage(const QString& name, int idx)
 {
 	logFine("Lua::LuaThreadAdapter::saveImage");
+	waitForRequest(m_win->fileRequest(), false);
 	bool n = m_win->saveImage(name, idx);
-	waitForEvent();
+	if (n)
+		waitForRequest(m_win->fileRequest(), true);
 	return n;
 }
 
-void Lua::LuaThreadAdapter::flameRenderedSlot(RenderEvent* /*e*/)
+/**
+ * Starts rendering a copy of the genome to the named png file, and returns
+ * an id for the render.  The render is queued along with the other small
+ * jobs, so several of them can be in flight at once.
+ */
+int Lua::LuaThreadAdapter::renderAsync(flam3_genome* g, const QString& name)
 {
-	logFine("Lua::LuaThreadAdapter::flameRenderedSlot : signaling wait event");
-	if (m_mutex.tryLock())
-		m_mutex.unlock();
-	else
-		m_mutex.unlock();
+	AsyncRender* a = new AsyncRender;
+	a->genome = flam3_genome();
+	flam3_copy(&a->genome, g);
+	a->event = 0;
+	a->done = false;
+	a->collected = false;
+	a->saved = false;
+	a->request.setGenome(&a->genome);
+	a->request.setImagePresets(a->genome);
+	a->request.setName(name);
+	a->request.setType(RenderRequest::Queued);
+
+	QMutexLocker locker(&m_mutex);
+	int id = m_next_id++;
+	m_async.insert(id, a);
+	locker.unlock();
+
+	logFine(QString("Lua::LuaThreadAdapter::renderAsync : render %1 to %2")
+			.arg(id).arg(name));
+	m_win->renderThread()->render(&a->request);
+	return id;
 }
 
-void Lua::LuaThreadAdapter::mainWindowChangedSlot()
+bool Lua::LuaThreadAdapter::renderFinished(int id)
 {
-	logFine("Lua::LuaThreadAdapter::mainWindowChangedSlot : signaling wait event");
-	if (m_mutex.tryLock())
-		m_mutex.unlock();
-	else
-		m_mutex.unlock();
+	QMutexLocker locker(&m_mutex);
+	AsyncRender* a = m_async.value(id);
+	return a && a->done;
+}
+
+/**
+ * Blocks until the render with the given id is finished, and returns true
+ * if its image was saved.
+ */
+bool Lua::LuaThreadAdapter::waitRender(int id)
+{
+	QMutexLocker locker(&m_mutex);
+	AsyncRender* a = m_async.value(id);
+	if (!a)
+		return false;
+	int kills = m_kills;
+	while (!a->done && kills == m_kills && !m_thread->stopping())
+		m_rendered.wait(&m_mutex);
+	locker.unlock();
+	return collect(a);
+}
+
+/**
+ * Blocks until every render started by the script is finished, and returns
+ * true if all of their images were saved.
+ */
+bool Lua::LuaThreadAdapter::waitAllRenders()
+{
+	bool saved = true;
+	foreach (int id, m_async.keys())
+		saved = waitRender(id) && saved;
+	return saved;
+}
+
+/**
+ * Called when a script ends.  Renders still in flight from a finished
+ * script are waited on, and those from a stopped script are cancelled.
+ */
+void Lua::LuaThreadAdapter::finishRenders()
+{
+	if (!m_thread->stopping())
+		waitAllRenders();
+
+	QMutexLocker locker(&m_mutex);
+	QList<AsyncRender*> pending;
+	foreach (AsyncRender* a, m_async)
+		if (!a->done)
+			pending.append(a);
+	locker.unlock();
+
+	// kill() returns once no worker holds the request.  The requests stay
+	// in m_async meanwhile, so one that finishes before it's killed still
+	// has its event noted, and that's accepted when it's released.
+	foreach (AsyncRender* a, pending)
+		m_win->renderThread()->kill(&a->request);
+
+	locker.relock();
+	foreach (AsyncRender* a, m_async)
+		m_releaser->release(a);
+	m_async.clear();
+}
+
+// Save the image of a finished render, and release it.
+bool Lua::LuaThreadAdapter::collect(AsyncRender* a)
+{
+	QMutexLocker locker(&m_mutex);
+	if (!a->done || a->collected)
+		return a->saved;
+	a->collected = true;
+	locker.unlock();
+
+	QImage empty;
+	QString name(a->request.name());
+	bool saved = a->request.image().save(name, "png");
+	if (!saved)
+		logWarn(QString("Lua::LuaThreadAdapter::collect : couldn't save %1")
+				.arg(name));
+	a->request.setImage(empty);
+	locker.relock();
+	a->saved = saved;
+	return saved;
 }
 
-void Lua::LuaThreadAdapter::waitForEvent()
+/**
+ * Waits for the final image of a request.  Call it with false before
+ * submitting the request, and then with true to block until it is done.
+ * Changes to the main window, and stopping the script, end the wait early.
+ */
+void Lua::LuaThreadAdapter::waitForRequest(RenderRequest* req, bool wait)
 {
-	m_mutex.lock();
-	while(!m_mutex.tryLock())
+	QMutexLocker locker(&m_mutex);
+	if (!wait)
 	{
-		logFinest("Lua::LuaThreadAdapter::waitForEvent : waiting");
-		m_thread->msleep(10);
-		QCoreApplication::processEvents();
+		m_wait_request = req;
+		m_wait_done = false;
+		return;
 	}
-	m_mutex.unlock();
+	int interrupts = m_interrupts;
+	while (!m_wait_done && interrupts == m_interrupts)
+	{
+		logFinest("Lua::LuaThreadAdapter::waitForRequest : waiting");
+		m_rendered.wait(&m_mutex);
+	}
+	m_wait_request = 0;
 }
 
+// Called from the thread that emitted the event.
+void Lua::LuaThreadAdapter::flameRenderedSlot(RenderEvent* e)
+{
+	RenderRequest* req = e->request();
+	if (!req->finished())
+		return;
 
+	QMutexLocker locker(&m_mutex);
+	bool wake = false;
+	if (req == m_wait_request)
+	{
+		logFine("Lua::LuaThreadAdapter::flameRenderedSlot : signaling wait event");
+		m_wait_done = true;
+		wake = true;
+	}
+	foreach (AsyncRender* a, m_async)
+		if (&a->request == req)
+		{
+			logFine(QString("Lua::LuaThreadAdapter::flameRenderedSlot : %1 rendered")
+					.arg(req->name()));
+			// the event is accepted once the gui thread is done with it
+			a->event = e;
+			a->done = true;
+			wake = true;
+		}
+	if (wake)
+		m_rendered.wakeAll();
+}
+
+void Lua::LuaThreadAdapter::flameRenderingKilledSlot()
+{
+	logFine("Lua::LuaThreadAdapter::flameRenderingKilledSlot : signaling wait event");
+	QMutexLocker locker(&m_mutex);
+	m_kills++;
+	m_interrupts++;
+	m_rendered.wakeAll();
+}
+
+void Lua::LuaThreadAdapter::mainWindowChangedSlot()
+{
+	logFine("Lua::LuaThreadAdapter::mainWindowChangedSlot : signaling wait event");
+	QMutexLocker locker(&m_mutex);
+	m_interrupts++;
+	m_rendered.wakeAll();
+}
+
+
+
+Lua::AsyncRenderReleaser::AsyncRenderReleaser()
+ : QObject()
+{
+}
+
+Lua::AsyncRenderReleaser::~AsyncRenderReleaser()
+{
+	freeReleased();
+}
+
+/**
+ * Takes a render that the script is done with.  It's freed from the gui
+ * thread's event queue.
+ */
+void Lua::AsyncRenderReleaser::release(AsyncRender* a)
+{
+	QMutexLocker locker(&m_mutex);
+	m_released.append(a);
+	locker.unlock();
+	QMetaObject::invokeMethod(this, "freeReleased", Qt::QueuedConnection);
+}
+
+void Lua::AsyncRenderReleaser::freeReleased()
+{
+	QMutexLocker locker(&m_mutex);
+	QList<AsyncRender*> released(m_released);
+	m_released.clear();
+	locker.unlock();
+
+	foreach (AsyncRender* a, released)
+	{
+		if (a->event)
+			a->event->accept();
+		clear_cp(&a->genome, flam3_defaults_on);
+		delete a;
+	}
+}
 
 Lua::LuaThread* Lua::LuaThreadAdapter::thread() const
 {
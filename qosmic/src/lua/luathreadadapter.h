@@ -22,6 +22,8 @@
 
 #include <QObject>
 #include <QMutex>
+#include <QWaitCondition>
+#include <QMap>
 
 #include "luathread.h"
 
@@ -32,6 +34,39 @@ class MainWindow;
 namespace Lua
 {
 
+// an image started by frame:render_async()
+struct AsyncRender
+{
+	RenderRequest request;
+	flam3_genome genome;
+	RenderEvent* event;
+	bool done;
+	bool collected;
+	bool saved;
+};
+
+/**
+ * Frees the async renders that a script is done with.  The render events
+ * are also queued to the other listeners on the gui thread, so the renders
+ * are freed, and their events accepted, from the gui thread's event queue
+ * after those listeners have seen them.
+ */
+class AsyncRenderReleaser : public QObject
+{
+	Q_OBJECT
+
+	QMutex m_mutex;
+	QList<AsyncRender*> m_released;
+
+	public:
+		AsyncRenderReleaser();
+		~AsyncRenderReleaser();
+		void release(AsyncRender*);
+
+	private slots:
+		void freeReleased();
+};
+
 class LuaThreadAdapter : public QObject
 {
 	Q_OBJECT
@@ -40,6 +75,14 @@ class LuaThreadAdapter : public QObject
 	LuaThread* m_thread;
 	QList<bool> m_modified;
 	QMutex m_mutex;
+	QWaitCondition m_rendered;
+	RenderRequest* m_wait_request;
+	bool m_wait_done;
+	int m_interrupts;
+	int m_kills;
+	QMap<int, AsyncRender*> m_async;
+	AsyncRenderReleaser* m_releaser;
+	int m_next_id;
 
 	public:
 		static const char RegKey;
@@ -61,9 +104,15 @@ class LuaThreadAdapter : public QObject
 		bool loadFile(const QString&);
 		bool saveFile(const QString&);
 		bool saveImage(const QString&, int =0);
+		int renderAsync(flam3_genome*, const QString&);
+		bool renderFinished(int);
+		bool waitRender(int);
+		bool waitAllRenders();
+		void finishRenders();
 
 	public slots:
 		void flameRenderedSlot(RenderEvent* e);
+		void flameRenderingKilledSlot();
 		void mainWindowChangedSlot();
 
 	signals:
@@ -71,7 +120,8 @@ class LuaThreadAdapter : public QObject
 		void updateSignal();
 
 	private:
-		void waitForEvent();
+		void waitForRequest(RenderRequest*, bool);
+		bool collect(AsyncRender*);
 };
 
 }
@@ -0,0 +1,79 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "renderhandle.h"
+#include "luathreadadapter.h"
+
+#define method(name) {#name, &RenderHandle::name}
+namespace Lua
+{
+
+const char RenderHandle::className[] = "RenderHandle";
+
+Lunar<RenderHandle>::RegType RenderHandle::methods[] =
+{
+	method(wait),
+	method(finished),
+	method(id),
+	{ 0, 0 }
+};
+
+RenderHandle::RenderHandle(lua_State* L) : LuaType(), m_id(-1)
+{
+	/* retrieve a context */
+	lua_pushlightuserdata(L, (void*)&LuaThreadAdapter::RegKey);  /* push address */
+	lua_gettable(L, LUA_REGISTRYINDEX);  /* retrieve value */
+	setContext(static_cast<LuaThreadAdapter*>(lua_touserdata(L, -1)));
+	lua_pop(L, 1);
+}
+
+RenderHandle::~RenderHandle()
+{
+}
+
+void RenderHandle::setId(int id)
+{
+	m_id = id;
+}
+
+int RenderHandle::wait(lua_State* L)
+{
+	bool saved = m_adapter->waitRender(m_id);
+	lua_settop(L, 0);
+	if (m_adapter->thread()->stopping())
+		return luaL_error(L, "stopping", "");
+	lua_pushboolean(L, saved);
+	return 1;
+}
+
+int RenderHandle::finished(lua_State* L)
+{
+	lua_settop(L, 0);
+	lua_pushboolean(L, m_adapter->renderFinished(m_id));
+	return 1;
+}
+
+int RenderHandle::id(lua_State* L)
+{
+	lua_settop(L, 0);
+	lua_pushinteger(L, m_id);
+	return 1;
+}
+
+}
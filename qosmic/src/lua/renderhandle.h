@@ -0,0 +1,52 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef RENDERHANDLE_LUA_H
+#define RENDERHANDLE_LUA_H
+
+#include "luatype.h"
+#include "lunar.h"
+
+
+namespace Lua
+{
+/**
+ * The handle returned by frame:render_async().  Calling wait() blocks the
+ * script until the image is rendered and saved.
+ */
+class RenderHandle : public LuaType
+{
+	int m_id;
+
+	public:
+		RenderHandle(lua_State*);
+		~RenderHandle();
+
+		// lua interface
+		int wait(lua_State*);
+		int finished(lua_State*);
+		int id(lua_State*);
+
+		void setId(int);
+		static const char className[];
+		static Lunar<RenderHandle>::RegType methods[];
+};
+}
+
+#endif
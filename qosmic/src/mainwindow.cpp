@@ -23,6 +23,7 @@
 #include <QSettings>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QInputDialog>
 
 #include "qosmic.h"
 #include "mainwindow.h"
@@ -38,6 +39,10 @@ MainWindow::MainWindow()
 	m_rthread = 0;
 	lastSelected = 0;
 	m_fileViewer = 0;
+	m_exporter = 0;
+	m_exportProgress = 0;
+	m_sheep_next = 0;
+	m_sheep_received = 0;
 	m_dialogsEnabled = true;
 	genomes.setSelected(0);
 	genomes.undoProviders()->append(this);
@@ -46,6 +51,7 @@ MainWindow::MainWindow()
 	m_preview_request.setGenome(genomes.data());
 	m_preview_request.setName(tr("preview"));
 	m_preview_request.setType(RenderRequest::Preview);
+	m_preview_request.setPasses(3); // show coarse previews while editing
 
 	m_viewer_request.setGenome(genomes.data());
 	m_viewer_request.setName(tr("viewer"));
@@ -358,6 +364,7 @@ MainWindow::MainWindow()
 	m_dockWidgets << dock;
 	connect(m_sheepLoopWidget, SIGNAL(runSheepLoop(bool)), this, SLOT(runSheepLoop(bool)));
 	connect(m_sheepLoopWidget, SIGNAL(saveSheepLoop()), this, SLOT(saveSheepLoop()));
+	connect(m_sheepLoopWidget, SIGNAL(exportSheepLoop()), this, SLOT(exportSheepLoop()));
 	connect(m_rthread, SIGNAL(flameRenderingKilled()), m_sheepLoopWidget, SLOT(reset()));
 	connect(m_genomeSelectWidget, SIGNAL(genomeSelected(int)), m_sheepLoopWidget, SLOT(genomeSelectedSlot(int)));
 	connect(m_genomeSelectWidget, SIGNAL(genomesModified()), m_sheepLoopWidget, SLOT(genomesModifiedSlot()));
@@ -436,13 +443,29 @@ void MainWindow::flameRenderedSlot(RenderEvent* e)
 		m_viewer->setPixmap(QPixmap::fromImage(req->image()));
 		e->accept();
 	}
-	else if (req->name().contains(QString("sheep")))
+	else if (m_sheep_requests.contains(req))
 	{
-		logFiner(QString("MainWindow::flameRenderedSlot : displaying sheep %1").arg(req->name()));
-		m_previewWidget->setPixmap(QPixmap::fromImage(req->image()));
-		// tell the sheeploop widget that the last frame has been shown
-		if (req == m_sheep_requests.last())
+		// the frames are rendered in parallel, so they're shown in order
+		// once each of the frames before them has been shown.  A failed
+		// frame is kept as a null image, and skipped.
+		if (req->finished())
+		{
+			m_sheep_frames.insert((int)req->time(),
+				req->failed() ? QImage() : req->image());
+			m_sheep_received++;
+		}
+		while (m_sheep_frames.contains(m_sheep_next))
+			showSheepFrame(m_sheep_next++);
+		// once every frame has arrived, show the rest in order past any
+		// that are missing, and tell the sheeploop widget the loop is done
+		if (m_sheep_received >= m_sheep_requests.size())
+		{
+			foreach (int frame, m_sheep_frames.keys())
+				showSheepFrame(frame);
+			m_sheep_next = 0;
+			m_sheep_received = 0;
 			m_sheepLoopWidget->reset();
+		}
 		e->accept();
 	}
 	else if (req == &m_file_request)
@@ -450,6 +473,19 @@ void MainWindow::flameRenderedSlot(RenderEvent* e)
 }
 
 
+void MainWindow::showSheepFrame(int frame)
+{
+	QImage img(m_sheep_frames.take(frame));
+	if (img.isNull())
+	{
+		logWarn(QString("MainWindow::showSheepFrame : skipping sheep %1").arg(frame));
+		return;
+	}
+	logFiner(QString("MainWindow::showSheepFrame : displaying sheep %1").arg(frame));
+	m_previewWidget->setPixmap(QPixmap::fromImage(img));
+}
+
+
 void MainWindow::updateStatus(double posX, double posY)
 {
 	double tx, ty;
@@ -503,6 +539,7 @@ void MainWindow::closeEvent(QCloseEvent* event)
 {
 	logInfo("MainWindow::closeEvent : saving current genome");
 	Flam3FileStream::autoSave(&genomes, GenomeVector::SaveOnExit | GenomeVector::AlwaysSave);
+	Flam3FileStream::flushAutoSave();
 	m_rthread->stopRendering();
     m_rthread->running = false;
 
@@ -722,7 +759,8 @@ bool MainWindow::saveImage(const QString& filename, int idx)
 		RenderProgressDialog progress(this, m_rthread);
 		if (progress.exec() == QDialog::Rejected)
 		{
-			m_rthread->stopRendering();
+			m_rthread->cancel(&m_file_request);
+			m_rthread->stopRendering(&m_file_request);
 			return false;
 		}
 		else
@@ -1332,6 +1370,8 @@ MainWindow::~MainWindow()
 	delete m_paletteEditor;
 	delete m_viewer;
 	delete m_xfeditor;
+	// the exporter's requests must be dropped before the render thread
+	delete m_exporter;
 	delete m_rthread;
 }
 
@@ -1361,8 +1401,7 @@ void MainWindow::mainViewerResizedAction(const QSize& s)
 		logFine(QString("MainWindow::mainViewerResizedAction : new size %1,%2")
 				.arg(s.width()).arg(s.height()));
 		m_rthread->cancel(&m_viewer_request);
-		if (m_rthread->current() == &m_viewer_request)
-			m_rthread->stopRendering();
+		m_rthread->stopRendering(&m_viewer_request);
 		renderViewer();
 	}
 }
@@ -1380,6 +1419,10 @@ void MainWindow::previewResizedAction(const QSize& s)
 
 void MainWindow::render()
 {
+	// anything still rendering the edited genome is out of date
+	m_rthread->genomeChanged(genomes.selectedGenome());
+	if (m_triangleDensityWidget->hasMergedGenome())
+		m_rthread->genomeChanged(m_triangleDensityWidget->getMergedGenome());
 	renderPreview();
 	renderViewer();
 }
@@ -1407,7 +1450,11 @@ void MainWindow::renderViewer()
 	}
 }
 
-void MainWindow::renderPreview(int idx)
+/**
+ * Renders the preview for the genome at idx, or the selected genome.
+ * Returns false if the preview is hidden and nothing was rendered.
+ */
+bool MainWindow::renderPreview(int idx)
 {
 	if (m_previewWidget->isVisible())
 	{
@@ -1429,7 +1476,9 @@ void MainWindow::renderPreview(int idx)
 		else
 			m_preview_request.setImagePresets(*render_genome);
 		m_rthread->render(&m_preview_request);
+		return true;
 	}
+	return false;
 }
 
 
@@ -1558,11 +1607,20 @@ RenderThread* MainWindow::renderThread() const
 	return m_rthread;
 }
 
+RenderRequest* MainWindow::previewRequest()
+{
+	return &m_preview_request;
+}
+
+RenderRequest* MainWindow::fileRequest()
+{
+	return &m_file_request;
+}
+
 void MainWindow::mainViewerHiddenAction()
 {
 	// stop rendering the mainviewer if it's waiting for an image.
-	if (m_rthread->isRendering() && m_rthread->current() == &m_viewer_request)
-		m_rthread->stopRendering();
+	m_rthread->stopRendering(&m_viewer_request);
 }
 
 bool MainWindow::eventFilter(QObject* /*obj*/, QEvent* event)
@@ -1670,6 +1728,9 @@ void MainWindow::runSheepLoop(bool flag)
 			while (m_sheep_requests.size() > dncp)
                 delete m_sheep_requests.takeLast();
 
+			m_sheep_frames.clear();
+			m_sheep_next = 0;
+			m_sheep_received = 0;
 			run_sequence = true;
 			for (int i = 0 ; run_sequence && i < dncp ; i++)
 			{
@@ -1724,3 +1785,132 @@ void MainWindow::saveSheepLoop()
 		}
 	}
 }
+
+/**
+ * Render every frame of the sheep loop to numbered png files, or to a y4m
+ * stream if the file name ends in .y4m.
+ */
+void MainWindow::exportSheepLoop()
+{
+	if (m_exporter && m_exporter->isRunning())
+	{
+		m_exportProgress->show();
+		m_exportProgress->raise();
+		return;
+	}
+
+	// the running sheep loop still uses the widget's shared genomes, so the
+	// exporter gets its own copy of them
+	int dncp = 0;
+	flam3_genome* sheep = m_sheepLoopWidget->newSheepLoop(dncp);
+	if (sheep == NULL || dncp < 1)
+	{
+		free(sheep);
+		return;
+	}
+	bool started = startSheepExport(sheep, dncp);
+	for (int i = 0 ; i < dncp ; i++)
+		clear_cp(sheep + i, flam3_defaults_on);
+	free(sheep);
+	if (!started)
+		return;
+
+	m_exportProgress->setRange(0, dncp);
+	m_exportProgress->setValue(0);
+	m_exportProgress->setLabelText(tr("Rendering %1 frames").arg(dncp));
+	m_exportProgress->show();
+}
+
+/**
+ * Ask for the export file and settings, and start exporting the frames.
+ * The exporter copies the genomes.
+ */
+bool MainWindow::startSheepExport(flam3_genome* sheep, int dncp)
+{
+	QSize currentSize(sheep->width, sheep->height);
+	RenderDialog dialog(this, "sheep.png", lastDir, currentSize,
+		ViewerPresetsModel::getInstance()->presetNames());
+	dialog.setWindowTitle(tr("Export frames"));
+	if (dialog.exec() != QDialog::Accepted)
+		return false;
+
+	QString fileName(dialog.absoluteFilePath());
+	if (fileName.isEmpty() || !QFileInfo(QFileInfo(fileName).path()).isWritable())
+	{
+		QMessageBox::warning(this, tr("Application error"),
+			tr("Cannot write file %1\n").arg(fileName));
+		logWarn(QString("MainWindow::exportSheepLoop : couldn't export to %1")
+			.arg(fileName));
+		return false;
+	}
+	lastDir = QFileInfo(fileName).dir().canonicalPath();
+
+	flam3_genome presets(*sheep);
+	if (dialog.presetSelected())
+		presets = ViewerPresetsModel::getInstance()->preset(dialog.selectedPreset());
+	QSize fileSize;
+	if (dialog.sizeSelected())
+		fileSize = dialog.selectedSize();
+
+	int fps = 30;
+	if (QFileInfo(fileName).suffix().toLower() == "y4m")
+	{
+		bool ok;
+		fps = QInputDialog::getInt(this, tr("Export frames"),
+			tr("Frames per second"), fps, 1, 120, 1, &ok);
+		if (!ok)
+			return false;
+	}
+
+	if (!m_exporter)
+	{
+		m_exporter = new FrameExporter();
+		connect(m_exporter, SIGNAL(progress(int, int, double, int)),
+			this, SLOT(sheepExportProgress(int, int, double, int)));
+		connect(m_exporter, SIGNAL(finished(bool)),
+			this, SLOT(sheepExportFinished(bool)));
+
+		m_exportProgress = new QProgressDialog(this);
+		m_exportProgress->setWindowTitle(tr("Export frames"));
+		m_exportProgress->setAutoClose(false);
+		m_exportProgress->setAutoReset(false);
+		m_exportProgress->setMinimumDuration(0);
+		connect(m_exportProgress, SIGNAL(canceled()),
+			this, SLOT(sheepExportCanceled()));
+	}
+
+	if (!m_exporter->start(sheep, dncp, fileName, fileSize, presets, fps))
+	{
+		QMessageBox::warning(this, tr("Application error"),
+			m_exporter->errorString());
+		return false;
+	}
+	return true;
+}
+
+void MainWindow::sheepExportProgress(int frame, int total, double fps, int eta)
+{
+	m_exportProgress->setValue(frame);
+	m_exportProgress->setLabelText(
+		tr("Frame %1 of %2\n%3 frames/sec, %4 remaining")
+		.arg(frame).arg(total).arg(fps, 0, 'f', 2)
+		.arg(QTime(0, 0).addSecs(eta).toString("hh:mm:ss")));
+}
+
+void MainWindow::sheepExportFinished(bool ok)
+{
+	m_exportProgress->hide();
+	if (ok)
+		statusBar()->showMessage(tr("Exported %1 frames")
+			.arg(m_exporter->frames()), 2000);
+	else
+		QMessageBox::warning(this, tr("Application error"),
+			m_exporter->errorString());
+}
+
+void MainWindow::sheepExportCanceled()
+{
+	m_exporter->cancel();
+	m_exportProgress->hide();
+	statusBar()->showMessage(tr("Export canceled"), 2000);
+}
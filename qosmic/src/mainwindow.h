@@ -22,6 +22,8 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QProgressDialog>
+#include <QMap>
 
 #include "ui_mainwindow.h"
 #include "renderthread.h"
@@ -46,6 +48,7 @@
 #include "editmodeselectorwidget.h"
 #include "sheeploopwidget.h"
 #include "xfedit.h"
+#include "frameexporter.h"
 
 class MainWindow
 : public QMainWindow, public UndoStateProvider, public QosmicWidget, private Ui::MainWindow
@@ -69,10 +72,12 @@ class MainWindow
 		bool exportGenome(const QString&, int);
 		void provideState(UndoState*);
 		void restoreState(UndoState*);
+		RenderRequest* previewRequest();
+		RenderRequest* fileRequest();
 
 	public slots:
 		void render();
-		void renderPreview(int =-1);
+		bool renderPreview(int =-1);
 		void renderViewer();
 		void flameRenderedSlot(RenderEvent* e);
 		void triangleSelectedSlot(Triangle*);
@@ -98,6 +103,7 @@ class MainWindow
 		void exportAction();
 		void runSheepLoop(bool);
 		void saveSheepLoop();
+		void exportSheepLoop();
 
 	signals:
 		void mainWindowChanged();
@@ -117,6 +123,9 @@ class MainWindow
 		void undo();
 		void redo();
 		void kill();
+		void sheepExportProgress(int, int, double, int);
+		void sheepExportFinished(bool);
+		void sheepExportCanceled();
 
 	private:
 		void createActions();
@@ -128,6 +137,8 @@ class MainWindow
 		QString strippedName(const QString&);
 		void updateRecentFileActions();
 		void setUndoState(UndoState*);
+		bool startSheepExport(flam3_genome*, int);
+		void showSheepFrame(int);
 
 	protected:
 		GenomeVector genomes;
@@ -135,6 +146,11 @@ class MainWindow
 		RenderRequest m_viewer_request;
 		RenderRequest m_file_request;
 		RenderRequestList m_sheep_requests;
+		QMap<int, QImage> m_sheep_frames;
+		int m_sheep_next;
+		int m_sheep_received;
+		FrameExporter* m_exporter;
+		QProgressDialog* m_exportProgress;
 		bool m_dialogsEnabled;
 
 		FigureEditor* m_xfeditor;
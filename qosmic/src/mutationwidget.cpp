@@ -22,17 +22,96 @@
 #include <QPainter>
 #include <QDrag>
 #include <QMimeData>
+#include <QRunnable>
 
 #include "mutationwidget.h"
 #include "viewerpresetsmodel.h"
 #include "logger.h"
 
+/**
+ * Creates one mutation or crossover candidate on the MutationWidget's thread
+ * pool.  The parents are copied when the job is created, and each job has
+ * its own isaac stream, so the jobs share no state with each other or with
+ * the gui thread.  The result is handed back to MutationWidget::candidateReady().
+ */
+class CandidateJob : public QRunnable
+{
+	QObject* receiver;
+	int generation;
+	int index;
+	int mode;
+	bool crossing;
+	double speed;
+	flam3_genome parent_a;
+	flam3_genome parent_b;
+	randctx rc;
+
+	public:
+		CandidateJob(QObject* r, int gen, int idx, quint32 stream)
+		: receiver(r), generation(gen), index(idx), mode(0), crossing(false),
+		  speed(0.0), parent_a(), parent_b()
+		{
+			Util::init_randctx(&rc, stream);
+		}
+
+		~CandidateJob()
+		{
+			clear_cp(&parent_a, flam3_defaults_on);
+			clear_cp(&parent_b, flam3_defaults_on);
+		}
+
+		void mutate(flam3_genome* a, int m, double s)
+		{
+			flam3_copy(&parent_a, a);
+			mode = m;
+			speed = s;
+			crossing = false;
+		}
+
+		void cross(flam3_genome* a, flam3_genome* b, int m)
+		{
+			flam3_copy(&parent_a, a);
+			flam3_copy(&parent_b, b);
+			mode = m;
+			crossing = true;
+		}
+
+		void run()
+		{
+			flam3_genome* result = new flam3_genome();
+			// flam3_mutate() calls add_to_action() which needs this size char[]
+			char modstr[flam3_max_action_length] = "";
+			if (crossing)
+				flam3_cross(&parent_a, &parent_b, result, mode, &rc, modstr);
+			else
+			{
+				int variations[flam3_nvariations] = { flam3_variation_random };
+				flam3_copy(result, &parent_a);
+				flam3_mutate(result, mode, variations, 1, 0, speed, &rc, modstr);
+			}
+			if (result->num_xforms > 0)
+			{
+				// apply any symmetry set by the mutation
+				flam3_add_symmetry(result, result->symmetry);
+				result->symmetry = 1;
+			}
+			QMetaObject::invokeMethod(receiver, "candidateReady",
+				Qt::QueuedConnection, Q_ARG(int, generation), Q_ARG(int, index),
+				Q_ARG(void*, result), Q_ARG(QString, QString(modstr)));
+		}
+};
+
+
 MutationWidget::MutationWidget(GenomeVector* gen,  RenderThread* t, QWidget* parent)
 : QWidget(parent), genome_offset(0), labels_size(82,68), mutation_speed(0.1),
-  mutateA_start(0), mutateB_start(0), genome(gen), rthread(t)
+  mutateA_start(0), mutateB_start(0), genome(gen), rthread(t),
+  generations(40, 0), pending(40, false), cross_wanted(8, false)
 {
 	setupUi(this);
 
+	// candidates are created on a few threads and rendered as they're ready
+	pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount() / 2, 4));
+
 	labels << label_a1 << label_a2 << label_a3  // labels are defined in the .ui file
 		   << label_a4 << label_a5 << label_a6
 		   << label_a7 << label_a8
@@ -150,11 +229,14 @@ void MutationWidget::showConfigDialog()
 	}
 	if (render)
 	{
-		cancelRequests();
-		foreach (RenderRequest* r, requests)
+		// the candidates still being created are rendered when they're ready
+		cancelRenders(0, 40);
+		for (int n = 0 ; n < requests.size() ; n++)
 		{
+			RenderRequest* r = requests.at(n);
 			r->setSize(labels_size);
-			rthread->render(r);
+			if (!pending[n])
+				rthread->render(r);
 		}
 	}
 }
@@ -185,7 +267,7 @@ void MutationWidget::rotateAMutationsUp()
 	(*e)->setToolTip(tmp_tip);
 	(*e)->setFrameColor(tmp_color);
 	(*e)->update();
-	cancelRequests();
+	cancelRequests(16, 40);
 	cross();
 }
 
@@ -215,7 +297,7 @@ void MutationWidget::rotateAMutationsDown()
 	(*e)->setToolTip(tmp_tip);
 	(*e)->setFrameColor(tmp_color);
 	(*e)->update();
-	cancelRequests();
+	cancelRequests(16, 40);
 	cross();
 }
 
@@ -244,7 +326,7 @@ void MutationWidget::rotateBMutationsUp()
 	(*e)->setToolTip(tmp_tip);
 	(*e)->setFrameColor(tmp_color);
 	(*e)->update();
-	cancelRequests();
+	cancelRequests(16, 40);
 	cross();
 }
 
@@ -273,7 +355,7 @@ void MutationWidget::rotateBMutationsDown()
 	(*e)->setToolTip(tmp_tip);
 	(*e)->setFrameColor(tmp_color);
 	(*e)->update();
-	cancelRequests();
+	cancelRequests(16, 40);
 	cross();
 }
 
@@ -301,7 +383,8 @@ void MutationWidget::selectorAIndexChangedSlot(int idx)
 		requests[0]->setGenome(mutations.at(0));
 	}
 
-	cancelRequests();
+	cancelRequests(0, 8);
+	cancelRequests(16, 40);
 	mutateAB('a');
 	cross();
 }
@@ -329,7 +412,7 @@ void MutationWidget::selectorBIndexChangedSlot(int idx)
 		requests[8]->setGenome(mutations.at(8));
 	}
 
-	cancelRequests();
+	cancelRequests(8, 40);
 	mutateAB('b');
 	cross();
 }
@@ -358,7 +441,8 @@ void MutationWidget::mutationASelectedAction(MutationPreviewWidget* ptr)
 				mutations.swap(idx, 0);
 				labels[0]->setGenome(ptr->genome());
 			}
-			cancelRequests();
+			cancelRequests(0, 8);
+			cancelRequests(16, 40);
 			mutateAB('a');
 			cross();
 		}
@@ -382,7 +466,7 @@ void MutationWidget::mutationBSelectedAction(MutationPreviewWidget* ptr)
 				mutations.swap(idx, 8);
 				labels[8]->setGenome(ptr->genome());
 			}
-			cancelRequests();
+			cancelRequests(8, 40);
 			mutateAB('b');
 			cross();
 		}
@@ -394,8 +478,7 @@ void MutationWidget::mutationBSelectedAction(MutationPreviewWidget* ptr)
 void MutationWidget::flameRenderedAction(RenderEvent* e)
 {
 	RenderRequest* req = e->request();
-	if (!(req->type() == RenderRequest::Queued
-			   && requests.contains(req)) )
+	if (!requests.contains(req))
 		return;
 
 	int idx = requests.indexOf(req, 0);
@@ -417,99 +500,132 @@ void MutationWidget::showEvent(QShowEvent* e)
 
 #define genome_ptr (genome->selectedGenome())
 
-void MutationWidget::cancelRequests()
+/**
+ * Drop the candidates still being created for the slots first to last - 1,
+ * and cancel their renders.  The slots are A at 0-7, B at 8-15, and the
+ * crosses at 16-39.  The other slots' candidates are kept.
+ */
+void MutationWidget::cancelRequests(int first, int last)
+{
+	for (int n = first ; n < last ; n++)
+	{
+		generations[n]++;
+		pending[n] = false;
+		if (n >= 16)
+			cross_wanted[(n - 16) / 3] = false;
+	}
+	cancelRenders(first, last);
+}
+
+void MutationWidget::cancelRenders(int first, int last)
 {
 	rthread->running_mutex.lock();
-	foreach (RenderRequest* req, requests)
+	for (int n = first ; n < last ; n++)
 	{
+		RenderRequest* req = requests.at(n);
 		if (!req->finished())
 			rthread->cancel(req);
 	}
 	rthread->running_mutex.unlock();
 }
 
+/**
+ * Render genome A or B, and start creating its seven mutations.
+ */
 void MutationWidget::mutateAB(char ab='a')
 {
-	flam3_genome tmp_genome = flam3_genome();
-	int variations[flam3_nvariations] = { flam3_variation_random };
-	int nvars = 1;
-	int symmetry = 0;
-	double speed = mutation_speed;
 	int mutate_mode = mutateA_start;
-	int mutate_idx  = 0;
 	int start_idx = 0;
-	int end_idx = 8;
 	if (ab == 'b')
 	{
 		start_idx = 8;
-		end_idx = 16;
 		mutate_mode = mutateB_start;
 	}
-	for ( int n = start_idx ; n < end_idx ; n++ )
+
+	logFine(QString("MutationWidget::mutateAB : rendering genome %1").arg(start_idx));
+	RenderRequest* req = requests.at(start_idx);
+	req->setGenome(mutations.at(start_idx));
+	rthread->render(req);
+
+	for ( int n = start_idx + 1 ; n < start_idx + 8 ; n++ )
+	{
+		logFine(QString("MutationWidget::mutateAB : mutating %1 -> %2 mode %3").arg(start_idx).arg(n).arg(mutate_mode % 7));
+		CandidateJob* job = new CandidateJob(this, generations[n], n, jobSeed());
+		job->mutate(mutations.at(start_idx), mutate_mode++ % 7, mutation_speed);
+		pending[n] = true;
+		pool.start(job);
+	}
+}
+
+/**
+ * Cross each of the A genomes with the B genome below it.  The crosses wait
+ * for any mutations of their parents that are still being created.
+ */
+void MutationWidget::cross()
+{
+	cross_wanted.fill(true);
+	startCrosses();
+}
+
+void MutationWidget::startCrosses()
+{
+	for ( int k = 0 ; k < 8 ; k++ )
 	{
-		flam3_genome* g = mutations.at(n);
-		if ( (n % 8) == 0 )
-		{
-			logFine(QString("MutationWidget::mutateAB : rendering genome %1").arg(n));
-			mutate_idx  = n;
-		}
-		else
+		if (!cross_wanted[k] || pending[k] || pending[k + 8])
+			continue;
+
+		cross_wanted[k] = false;
+		for ( int j = 0 ; j < 3 ; j++ )
 		{
-			logFine(QString("MutationWidget::mutateAB : mutating %1 -> %2 mode %3").arg(mutate_idx).arg(n).arg(mutate_mode));
-			flam3_copy(&tmp_genome, mutations.at(mutate_idx));
-			// flam3_mutate() calls add_to_action() which needs this size char[]
-			char modstr[flam3_max_action_length] = "";
-			flam3_mutate(&tmp_genome, (mutate_mode++ % 7), variations, nvars, symmetry, speed, Util::get_isaac_randctx(), modstr);
-			if (tmp_genome.num_xforms > 0)
-			{
-				flam3_copy(g, &tmp_genome);
-				// apply any symmetry set by the mutation
-				flam3_add_symmetry(g, tmp_genome.symmetry);
-				g->symmetry = 1;
-				labels[n]->setToolTip(QString(modstr));
-				logFine(QString("MutationWidget::mutateAB : modstr '%1'").arg(QString(modstr)));
-			}
-			else
-				logWarn("MutationWidget::mutateAB : zero xforms in mutation");
+			int n = 16 + 3*k + j;
+			logFine(QString("MutationWidget::cross : crossing %1 and %2 -> %3 mode %4").arg(k).arg(k + 8).arg(n).arg(j));
+			CandidateJob* job = new CandidateJob(this, generations[n], n, jobSeed());
+			job->cross(mutations.at(k), mutations.at(k + 8), j);
+			pending[n] = true;
+			pool.start(job);
 		}
-		RenderRequest* req = requests.at(n);
-		req->setGenome(g);
-		rthread->render(req);
 	}
-	clear_cp(&tmp_genome, flam3_defaults_on);
 }
 
-void MutationWidget::cross()
+/**
+ * A candidate has been created.  Stale candidates are dropped, and the
+ * others are rendered right away.
+ */
+void MutationWidget::candidateReady(int gen, int idx, void* ptr, const QString& modstr)
 {
-	flam3_genome tmp_genome = flam3_genome();
-	for ( int n = 16, k = 0 ; n < 40 ; n += 3, k++ )
+	flam3_genome* result = static_cast<flam3_genome*>(ptr);
+	if (gen == generations[idx])
 	{
-		for ( int j = 0 ; j < 3 ; j++)
+		pending[idx] = false;
+		flam3_genome* g = mutations.at(idx);
+		if (result->num_xforms > 0)
 		{
-			flam3_genome* g = mutations.at(n + j);
-			flam3_genome* a = mutations.at(n - 16 - 2*k);
-			flam3_genome* b = mutations.at(n - 8  - 2*k);
-			char modstr[flam3_max_action_length] = "";
-			logFine(QString("MutationWidget::cross : crossing %1 and %2 -> %3 mode %4").arg(n - 16 - 2*k).arg(n - 8 - 2*k).arg(n + j).arg(j));
-			flam3_cross(a, b, &tmp_genome, j, Util::get_isaac_randctx(), modstr);
-			if (tmp_genome.num_xforms > 0)
-			{
-				flam3_copy(g, &tmp_genome);
-				// apply any symmetry set by the mutation
-				flam3_add_symmetry(g, tmp_genome.symmetry);
-				g->symmetry = 1;
-				labels[n + j]->setToolTip(QString(modstr));
-				logFine(QString("MutationWidget::cross : modstr '%1'").arg(QString(modstr)));
-			}
-			else
-				logWarn("MutationWidget::cross : zero xforms in cross");
-
-			RenderRequest* req = requests.at(n + j);
-			req->setGenome(g);
-			rthread->render(req);
+			flam3_copy(g, result);
+			labels[idx]->setToolTip(modstr);
+			logFine(QString("MutationWidget::candidateReady : %1 modstr '%2'").arg(idx).arg(modstr));
 		}
+		else
+			logWarn("MutationWidget::candidateReady : zero xforms in candidate %d", idx);
+
+		RenderRequest* req = requests.at(idx);
+		req->setGenome(g);
+		rthread->render(req);
+
+		// the crosses may have been waiting for this mutation
+		if (idx < 16)
+			startCrosses();
 	}
-	clear_cp(&tmp_genome, flam3_defaults_on);
+	clear_cp(result, flam3_defaults_on);
+	delete result;
+}
+
+/**
+ * The streams are taken on the gui thread in the order the candidates are
+ * created, so a batch of candidates is repeatable for a given master seed.
+ */
+quint32 MutationWidget::jobSeed()
+{
+	return Util::next_stream();
 }
 
 void MutationWidget::mutate()
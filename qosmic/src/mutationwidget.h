@@ -25,6 +25,7 @@
 #include <QMenu>
 #include <QLabel>
 #include <QMouseEvent>
+#include <QThreadPool>
 
 
 #include "genomevector.h"
@@ -91,7 +92,8 @@ class MutationWidget : public QWidget, private Ui::MutationWidget
 
 	protected:
 		void showEvent(QShowEvent*);
-		void cancelRequests();
+		void cancelRequests(int =0, int =40);
+		void cancelRenders(int, int);
 		void mutateAB(char);
 		void cross();
 
@@ -106,6 +108,9 @@ class MutationWidget : public QWidget, private Ui::MutationWidget
 		void showConfigDialog();
 		void mutate();
 
+	private slots:
+		void candidateReady(int, int, void*, const QString&);
+
 	signals:
 		void genomeSelected(flam3_genome*);
 
@@ -121,6 +126,13 @@ class MutationWidget : public QWidget, private Ui::MutationWidget
 		QList<MutationPreviewWidget*> labels;
 		QList<flam3_genome*> mutations;
 		QList<RenderRequest*> requests;
+		QThreadPool pool;
+		QVector<int> generations;
+		QVector<bool> pending;
+		QVector<bool> cross_wanted;
+
+		void startCrosses();
+		quint32 jobSeed();
 };
 
 #include "ui_mutationconfigdialog.h"
@@ -34,6 +34,8 @@ PaletteEditor::PaletteEditor ( QWidget* parent )
 	loadPalette(0);
 
 	m_palettesView->setModel(&m_flamPalettes);
+	// all swatches are the same size, so only the visible ones are drawn
+	m_palettesView->setUniformItemSizes(true);
 	m_browseView->setModel(&m_browsePalettes);
 	hasUGR = false;
 	QSettings settings;
@@ -415,25 +417,22 @@ void PaletteEditor::setPaletteView()
 
 void PaletteEditor::buildPaletteSelector()
 {
-	// only do this once, but it takes a while, so only when asked
+	// only do this once, and only when asked
 	static bool built = false;
 	if (built) return;
 	built = true;
 	logInfo("PaletteEditor::buildPaletteSelector : generating palettes");
-	QSize s = m_palettesView->iconSize();
+	QVector<QRgb> table(PaletteCount * 256);
+	QRgb* colors = table.data();
 	for (int n = 0 ; n < PaletteCount ; n++)
 	{
 		flam3_palette p;
 		flam3_get_palette(n, p, 0.0);
-		QImage palette(s.width(), s.height(), QImage::Format_RGB32);
-		QPainter painter(&palette);
 		for (int i = 0 ; i < 256 ; i++)
-		{
-			painter.setPen(QColor::fromRgbF(p[i].color[0], p[i].color[1], p[i].color[2]));
-			painter.drawLine(i, 0, i, s.height());
-		}
-		m_flamPalettes.addGradient(QPixmap::fromImage(palette));
+			*colors++ = qRgb((int)(p[i].color[0] * 255.0),
+				(int)(p[i].color[1] * 255.0), (int)(p[i].color[2] * 255.0));
 	}
+	m_flamPalettes.setPaletteTable(table, m_palettesView->iconSize());
 	if (!m_lastBrowseDir.isEmpty())
 	{
 		// restore p_stops for the initial call to resetGradientAction
@@ -0,0 +1,166 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <png.h>
+#include <stdio.h>
+
+#include "pngwriter.h"
+#include "logger.h"
+
+namespace Util
+{
+
+// the error pointer handed to libpng
+struct PngErrorState
+{
+	QString path;
+	QString error;
+};
+
+struct PngWriter::Private : public PngErrorState
+{
+	FILE* file;
+	png_structp png;
+	png_infop info;
+	int height;
+	int row;
+};
+
+static void png_error_handler(png_structp png, png_const_charp msg)
+{
+	PngErrorState* e = static_cast<PngErrorState*>(png_get_error_ptr(png));
+	e->error = QString(msg);
+	longjmp(png_jmpbuf(png), 1);
+}
+
+static void png_warning_handler(png_structp png, png_const_charp msg)
+{
+	PngErrorState* e = static_cast<PngErrorState*>(png_get_error_ptr(png));
+	logWarn(QString("PngWriter : %1 : %2").arg(e->path).arg(msg));
+}
+
+PngWriter::PngWriter()
+: d(new Private)
+{
+	d->file = 0;
+	d->png = 0;
+	d->info = 0;
+	d->height = 0;
+	d->row = 0;
+}
+
+PngWriter::~PngWriter()
+{
+	close();
+	delete d;
+}
+
+/**
+ * Create the file and write the png header.
+ */
+bool PngWriter::open(const QString& path, int width, int height, int channels)
+{
+	close();
+	d->path = path;
+	d->error.clear();
+	d->height = height;
+	d->row = 0;
+
+	d->file = fopen(path.toLocal8Bit().constData(), "wb");
+	if (!d->file)
+	{
+		d->error = QString("couldn't open %1 for writing").arg(path);
+		return false;
+	}
+
+	d->png = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+		static_cast<PngErrorState*>(d),
+		png_error_handler, png_warning_handler);
+	if (d->png)
+		d->info = png_create_info_struct(d->png);
+	if (!d->png || !d->info)
+	{
+		d->error = QString("couldn't allocate the png structures");
+		close();
+		return false;
+	}
+
+	if (setjmp(png_jmpbuf(d->png)))
+	{
+		close();
+		return false;
+	}
+	png_init_io(d->png, d->file);
+	png_set_IHDR(d->png, d->info, width, height, 8,
+		channels == 4 ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB,
+		PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+		PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(d->png, d->info);
+	return true;
+}
+
+bool PngWriter::writeRow(const unsigned char* row)
+{
+	if (!d->png)
+		return false;
+	if (setjmp(png_jmpbuf(d->png)))
+	{
+		close();
+		return false;
+	}
+	png_write_row(d->png, const_cast<png_bytep>(row));
+	d->row++;
+	return true;
+}
+
+/**
+ * Finish the file.  Returns false if the file wasn't open or if fewer rows
+ * than the image height were written.
+ */
+bool PngWriter::close()
+{
+	bool ok = d->png != 0 && d->row == d->height && d->error.isEmpty();
+	if (d->png)
+	{
+		if (setjmp(png_jmpbuf(d->png)) == 0 && ok)
+			png_write_end(d->png, d->info);
+		else
+			ok = false;
+		png_destroy_write_struct(&d->png, d->info ? &d->info : 0);
+		d->png = 0;
+		d->info = 0;
+	}
+	if (d->file)
+	{
+		if (fclose(d->file) != 0)
+			ok = false;
+		d->file = 0;
+	}
+	if (!ok && d->error.isEmpty() && d->row != d->height)
+		d->error = QString("only %1 of %2 rows were written")
+			.arg(d->row).arg(d->height);
+	return ok;
+}
+
+QString PngWriter::errorString() const
+{
+	return d->error;
+}
+
+}
@@ -0,0 +1,51 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <QString>
+
+namespace Util
+{
+	/**
+	 * Writes a png file one scanline at a time so that an image never has to
+	 * be held in memory all at once.  Rows are packed 8-bit RGB or RGBA
+	 * pixels, the same layout that flam3_render() produces.
+	 */
+	class PngWriter
+	{
+		public:
+			PngWriter();
+			~PngWriter();
+			bool open(const QString& path, int width, int height, int channels);
+			bool writeRow(const unsigned char* row);
+			bool close();
+			QString errorString() const;
+
+		private:
+			struct Private;
+			Private* d;
+
+			PngWriter(const PngWriter&);
+			PngWriter& operator=(const PngWriter&);
+	};
+}
+
+#endif // PNGWRITER_H
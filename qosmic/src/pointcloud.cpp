@@ -0,0 +1,528 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <QCryptographicHash>
+#include <QColor>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "pointcloud.h"
+#include "chaosgame.h"
+#include "logger.h"
+
+// libflam3 internals used to iterate a genome outside of flam3_render()
+extern "C" {
+int prepare_precalc_flags(flam3_genome*);
+void xform_precalc(flam3_genome*, int);
+}
+
+// the number of samples kept for each pixel of the genome, and the bounds
+// on the size of a cloud.  a sample takes 16 bytes.
+#define POINTCLOUD_SAMPLES_PER_PIXEL 4
+#define POINTCLOUD_MIN_SAMPLES (1 << 16)
+#define POINTCLOUD_MAX_SAMPLES (1 << 21)
+
+// the number of samples iterated between checks of the stop flag
+#define POINTCLOUD_BATCH (1 << 16)
+
+// the number of quantized color indexes counted for each pixel in the color
+// histogram mode, and the largest histogram kept, in bins.  larger images
+// bin their samples again when the palette changes.
+#define POINTCLOUD_COLOR_BINS 32
+#define POINTCLOUD_MAX_HISTOGRAM (1 << 23)
+
+// the same scales that flam3_render() uses for the buckets
+#define WHITE_LEVEL 255.0
+#define PREFILTER_WHITE 255.0
+
+namespace Util
+{
+
+PointCloud::PointCloud()
+: capacity(0), binned_samples(0), color_histogram(false)
+{
+	camera = binned = cameraOf(0);
+	tone = toneOf(0);
+}
+
+/**
+ * A hash of the xforms, the final xform, and the xaos of the genome.
+ * Genomes with the same key have the same attractor and the same color
+ * indexes.
+ */
+QByteArray PointCloud::shapeKey(const flam3_genome* g)
+{
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash_genome_xforms(hash, g);
+	return hash.result();
+}
+
+PointCloud::Camera PointCloud::cameraOf(const flam3_genome* g)
+{
+	Camera c;
+	memset(&c, 0, sizeof(Camera));
+	if (g)
+	{
+		c.center[0] = g->center[0];
+		c.center[1] = g->center[1];
+		c.rot_center[0] = g->rot_center[0];
+		c.rot_center[1] = g->rot_center[1];
+		c.rotate = g->rotate;
+		c.pixels_per_unit = g->pixels_per_unit;
+		c.zoom = g->zoom;
+		c.width = g->width;
+		c.height = g->height;
+	}
+	return c;
+}
+
+PointCloud::Tone PointCloud::toneOf(const flam3_genome* g)
+{
+	Tone t;
+	memset(&t, 0, sizeof(Tone));
+	if (g)
+	{
+		t.contrast = g->contrast;
+		t.brightness = g->brightness;
+		t.gamma = g->gamma;
+		t.vibrancy = g->vibrancy;
+		t.gam_lin_thresh = g->gam_lin_thresh;
+		t.highlight_power = g->highlight_power;
+		for (int j = 0 ; j < 3 ; j++)
+			t.background[j] = g->background[j];
+	}
+	return t;
+}
+
+QByteArray PointCloud::paletteOf(const flam3_genome* g)
+{
+	return QByteArray((const char*)g->palette, sizeof(flam3_palette));
+}
+
+bool PointCloud::sameShape(const flam3_genome* g) const
+{
+	return !shape.isEmpty() && shape == shapeKey(g);
+}
+
+bool PointCloud::sameCamera(const flam3_genome* g) const
+{
+	Camera c = cameraOf(g);
+	return memcmp(&c, &camera, sizeof(Camera)) == 0;
+}
+
+bool PointCloud::sameTone(const flam3_genome* g) const
+{
+	Tone t = toneOf(g);
+	return memcmp(&t, &tone, sizeof(Tone)) == 0;
+}
+
+bool PointCloud::samePalette(const flam3_genome* g) const
+{
+	return palette == paletteOf(g);
+}
+
+/**
+ * Count the samples by pixel and quantized color index when they're binned,
+ * so that palette edits don't have to bin them again.  This is meant for
+ * small images, like the preview.
+ */
+void PointCloud::setColorHistogram(bool enable)
+{
+	color_histogram = enable;
+	if (!enable)
+		histogram.clear();
+}
+
+/**
+ * Drop the samples and the buckets, and remember the shape, the camera, the
+ * tone, and the palette of the genome.
+ */
+void PointCloud::reset(const flam3_genome* g)
+{
+	shape = shapeKey(g);
+	setView(g);
+	samples.clear();
+	buckets.clear();
+	histogram.clear();
+	binned_samples = 0;
+	capacity = qBound(POINTCLOUD_MIN_SAMPLES,
+		g->width * g->height * POINTCLOUD_SAMPLES_PER_PIXEL,
+		POINTCLOUD_MAX_SAMPLES);
+}
+
+/**
+ * Remember the camera, the tone, and the palette of the last image made for
+ * the genome.
+ */
+void PointCloud::setView(const flam3_genome* g)
+{
+	camera = cameraOf(g);
+	tone = toneOf(g);
+	palette = paletteOf(g);
+}
+
+bool PointCloud::isFull() const
+{
+	return samples.size() >= capacity;
+}
+
+int PointCloud::size() const
+{
+	return samples.size();
+}
+
+/**
+ * Run the chaos game on the genome until the cloud is full, or until the
+ * stop flag is set.  Genomes that ChaosGame supports are iterated with its
+ * vector kernels, and the others with flam3_iterate().  A cloud that was
+ * stopped part way is still usable, and it's filled by the next call.
+ * Returns the number of samples added.
+ */
+int PointCloud::iterate(const flam3_genome* g, randctx* rc, volatile bool* stop)
+{
+	if (isFull())
+		return 0;
+
+	flam3_genome cp = flam3_genome();
+	flam3_copy(&cp, g);
+	ChaosGame game;
+	bool native = game.prepare(&cp, rc);
+	unsigned short* xform_distrib = 0;
+	if (!native)
+	{
+		if (prepare_precalc_flags(&cp) == 0)
+		{
+			for (int n = 0 ; n < cp.num_xforms ; n++)
+				xform_precalc(&cp, n);
+			xform_distrib = flam3_create_xform_distrib(&cp);
+		}
+		if (xform_distrib == 0)
+		{
+			logWarn("PointCloud::iterate : cannot iterate genome");
+			clear_cp(&cp, flam3_defaults_on);
+			return 0;
+		}
+	}
+
+	int start = samples.size();
+	samples.reserve(capacity);
+	QVector<double> points(4 * POINTCLOUD_BATCH);
+	while (!isFull() && !(stop && *stop))
+	{
+		int n = qMin(POINTCLOUD_BATCH, capacity - samples.size());
+		double* p = points.data();
+		if (native)
+			game.iterate(n, p, rc);
+		else
+		{
+			// each flam3 batch starts from a new random point
+			p[0] = flam3_random_isaac_11(rc);
+			p[1] = flam3_random_isaac_11(rc);
+			p[2] = flam3_random_isaac_01(rc);
+			p[3] = flam3_random_isaac_01(rc);
+			flam3_iterate(&cp, n, 20, p, xform_distrib, rc);
+		}
+		for (int i = 0 ; i < n ; i++, p += 4)
+		{
+			// skip the points that escaped
+			if (!std::isfinite(p[0]) || !std::isfinite(p[1]) || p[3] <= 0.0)
+				continue;
+			Sample s = { (float)p[0], (float)p[1], (float)p[2], (float)p[3] };
+			samples.append(s);
+		}
+	}
+	free(xform_distrib);
+	clear_cp(&cp, flam3_defaults_on);
+
+	logFine("PointCloud::iterate : %d of %d samples (%s)", samples.size(), capacity,
+		native ? ChaosGame::kernel() : "flam3");
+	return samples.size() - start;
+}
+
+/**
+ * Make an image of the genome from the cloud.  The samples are binned again
+ * only if the camera or the number of samples changed since they were last
+ * binned.  A new palette is applied to the kept color histogram, and
+ * otherwise the kept buckets are just tone mapped.
+ */
+void PointCloud::render(const flam3_genome* g, QImage& img, bool transparent)
+{
+	Camera c = cameraOf(g);
+	if (buckets.isEmpty() || binned_samples != samples.size()
+		|| memcmp(&c, &binned, sizeof(Camera)) != 0)
+		bin(g);
+	else if (binned_palette != paletteOf(g))
+		recolor(g);
+	toneMap(g, img, transparent);
+}
+
+/**
+ * Take the samples of another cloud of the same shape if it has more of
+ * them, so that the chaos game runs once for the early feedback images of
+ * a genome.
+ * The samples are implicitly shared until either cloud adds to them.
+ * Returns the number of samples gained.
+ */
+int PointCloud::share(const PointCloud& other)
+{
+	if (&other == this || shape.isEmpty() || other.shape != shape
+		|| other.samples.size() <= samples.size())
+		return 0;
+
+	int gained = other.samples.size() - samples.size();
+	samples = other.samples;
+	logFine("PointCloud::share : took %d samples", samples.size());
+	return gained;
+}
+
+/**
+ * Project the samples through the camera of the genome and accumulate
+ * their colors in buckets the size of the genome, the same way flam3
+ * fills its buckets.  In the color histogram mode they're counted in the
+ * histogram, and the buckets are filled from it.
+ */
+void PointCloud::bin(const flam3_genome* g)
+{
+	const int width  = g->width;
+	const int height = g->height;
+	binned = cameraOf(g);
+	binned_samples = samples.size();
+
+	// the histogram replaces the buckets while the samples are binned
+	float* b;
+	int stride;
+	bool counted = color_histogram
+		&& width * height * POINTCLOUD_COLOR_BINS <= POINTCLOUD_MAX_HISTOGRAM;
+	if (counted)
+	{
+		histogram.fill(0.0f, width * height * POINTCLOUD_COLOR_BINS);
+		b = histogram.data();
+		stride = POINTCLOUD_COLOR_BINS;
+	}
+	else
+	{
+		histogram.clear();
+		buckets.fill(0.0f, width * height * 5);
+		b = buckets.data();
+		stride = 5;
+	}
+
+	float cmap[256][4];
+	for (int n = 0 ; n < 256 ; n++)
+		for (int j = 0 ; j < 4 ; j++)
+			cmap[n][j] = g->palette[n].color[j] * WHITE_LEVEL;
+
+	const double ppu = g->pixels_per_unit * pow(2.0, g->zoom);
+	const double corner_x = g->center[0] - width / ppu / 2.0;
+	const double corner_y = g->center[1] - height / ppu / 2.0;
+	const double angle = -g->rotate * 2.0 * M_PI / 360.0;
+	const double rcos = cos(angle);
+	const double rsin = sin(angle);
+	const bool rotated = g->rotate != 0.0;
+
+	foreach (const Sample& s, samples)
+	{
+		double x = s.x;
+		double y = s.y;
+		if (rotated)
+		{
+			double dx = x - g->rot_center[0];
+			double dy = y - g->rot_center[1];
+			x = dx * rcos - dy * rsin + g->rot_center[0];
+			y = dx * rsin + dy * rcos + g->rot_center[1];
+		}
+		double px = (x - corner_x) * ppu;
+		double py = (y - corner_y) * ppu;
+		if (px < 0.0 || py < 0.0 || px >= width || py >= height)
+			continue;
+
+		int ci = qBound(0, (int)(s.color * 256.0f), 255);
+		float* bucket = b + stride * ((int)py * width + (int)px);
+		if (counted)
+			bucket[ci * POINTCLOUD_COLOR_BINS / 256] += s.opacity;
+		else
+		{
+			for (int j = 0 ; j < 4 ; j++)
+				bucket[j] += s.opacity * cmap[ci][j];
+			bucket[4] += s.opacity;
+		}
+	}
+
+	if (counted)
+		recolor(g);
+	else
+		binned_palette = paletteOf(g);
+}
+
+/**
+ * Fill the buckets from the color histogram with the palette of the genome.
+ * Each bin takes the mean color of the palette entries quantized into it.
+ * Without a histogram the samples are binned again.
+ */
+void PointCloud::recolor(const flam3_genome* g)
+{
+	const int npixels = binned.width * binned.height;
+	if (histogram.size() != npixels * POINTCLOUD_COLOR_BINS)
+	{
+		bin(g);
+		return;
+	}
+
+	const int span = 256 / POINTCLOUD_COLOR_BINS;
+	float cmap[POINTCLOUD_COLOR_BINS][4];
+	for (int k = 0 ; k < POINTCLOUD_COLOR_BINS ; k++)
+		for (int j = 0 ; j < 4 ; j++)
+		{
+			double sum = 0.0;
+			for (int n = k * span ; n < (k + 1) * span ; n++)
+				sum += g->palette[n].color[j];
+			cmap[k][j] = sum * WHITE_LEVEL / span;
+		}
+
+	buckets.resize(npixels * 5);
+	const float* h = histogram.constData();
+	float* b = buckets.data();
+	for (int p = 0 ; p < npixels ; p++, h += POINTCLOUD_COLOR_BINS, b += 5)
+	{
+		float rgba[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float count = 0.0f;
+		for (int k = 0 ; k < POINTCLOUD_COLOR_BINS ; k++)
+		{
+			if (h[k] == 0.0f)
+				continue;
+			for (int j = 0 ; j < 4 ; j++)
+				rgba[j] += h[k] * cmap[k][j];
+			count += h[k];
+		}
+		for (int j = 0 ; j < 4 ; j++)
+			b[j] = rgba[j];
+		b[4] = count;
+	}
+	binned_palette = paletteOf(g);
+}
+
+/**
+ * Tone map the buckets into the image.  This follows the log density,
+ * gamma, vibrancy, and highlight power steps of flam3_render() without the
+ * spatial and density estimation filters.  The background is composited
+ * unless the image is transparent.
+ */
+void PointCloud::toneMap(const flam3_genome* g, QImage& img, bool transparent) const
+{
+	const int width  = qMin(img.width(), binned.width);
+	const int height = qMin(img.height(), binned.height);
+
+	// the log density scale, with the sample density taken from the number
+	// of samples for each pixel of the image like flam3 does.
+	double density = qMax(1, binned_samples) / (double)(binned.width * binned.height);
+	double k1 = g->contrast * g->brightness * PREFILTER_WHITE * 268.0 / 256.0;
+	double k2 = 1.0 / (g->contrast * WHITE_LEVEL * density);
+
+	double gamma = 1.0 / qMax(g->gamma, 1e-6);
+	double linrange = g->gam_lin_thresh;
+	double vibrancy = g->vibrancy;
+	double highpow = g->highlight_power;
+	double bg[3];
+	for (int j = 0 ; j < 3 ; j++)
+		bg[j] = g->background[j] * WHITE_LEVEL;
+
+	for (int row = 0 ; row < height ; row++)
+	{
+		const float* b = buckets.constData() + 5 * row * binned.width;
+		QRgb* line = (QRgb*)img.scanLine(row);
+		for (int col = 0 ; col < width ; col++, b += 5)
+		{
+			double t[4] = { 0.0, 0.0, 0.0, 0.0 };
+			double ls = 0.0;
+			double alpha = 0.0;
+			if (b[4] > 0.0f)
+			{
+				double scale = k1 * log(1.0 + b[4] * k2) / b[4];
+				for (int j = 0 ; j < 4 ; j++)
+					t[j] = b[j] * scale;
+			}
+			if (t[3] > 0.0)
+			{
+				double tmp = t[3] / PREFILTER_WHITE;
+				if (tmp < linrange)
+				{
+					double frac = tmp / linrange;
+					alpha = (1.0 - frac) * tmp * pow(linrange, gamma) / linrange
+						+ frac * pow(tmp, gamma);
+				}
+				else
+					alpha = pow(tmp, gamma);
+				ls = vibrancy * 256.0 * alpha / tmp;
+				alpha = qBound(0.0, alpha, 1.0);
+			}
+
+			// keep the hue of saturated pixels like flam3_calc_newrgb()
+			double newrgb[3];
+			double maxa = -1.0;
+			double maxc = 0.0;
+			for (int j = 0 ; j < 3 ; j++)
+			{
+				double a = ls * t[j] / PREFILTER_WHITE;
+				if (a > maxa)
+				{
+					maxa = a;
+					maxc = t[j] / PREFILTER_WHITE;
+				}
+			}
+			if (maxa > 255.0 && highpow >= 0.0)
+			{
+				double newls = 255.0 / maxc;
+				double lsratio = pow(newls / ls, highpow);
+				QColor c = QColor::fromRgbF(
+					qMin(1.0, newls * t[0] / PREFILTER_WHITE / 255.0),
+					qMin(1.0, newls * t[1] / PREFILTER_WHITE / 255.0),
+					qMin(1.0, newls * t[2] / PREFILTER_WHITE / 255.0));
+				double h, sat, v;
+				c.getHsvF(&h, &sat, &v);
+				c.setHsvF(qMax(0.0, h), sat * lsratio, v);
+				newrgb[0] = c.redF() * 255.0;
+				newrgb[1] = c.greenF() * 255.0;
+				newrgb[2] = c.blueF() * 255.0;
+			}
+			else
+			{
+				double adjhlp = maxa <= 255.0 ? 1.0 : qMin(1.0, -highpow);
+				double newls = maxc > 0.0 ? 255.0 / maxc : 0.0;
+				for (int j = 0 ; j < 3 ; j++)
+					newrgb[j] = ((1.0 - adjhlp) * newls + adjhlp * ls)
+						* t[j] / PREFILTER_WHITE;
+			}
+
+			int rgb[3];
+			for (int j = 0 ; j < 3 ; j++)
+			{
+				double a = newrgb[j];
+				a += (1.0 - vibrancy) * 256.0 * pow(t[j] / PREFILTER_WHITE, gamma);
+				if (!transparent)
+					a += (1.0 - alpha) * bg[j];
+				rgb[j] = qBound(0, (int)a, 255);
+			}
+			line[col] = qRgba(rgb[0], rgb[1], rgb[2],
+				transparent ? (int)(alpha * 255.0) : 255);
+		}
+	}
+}
+
+}
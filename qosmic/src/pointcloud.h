@@ -0,0 +1,116 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef POINTCLOUD_H
+#define POINTCLOUD_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QVector>
+
+#include "flam3util.h"
+
+namespace Util
+{
+	/**
+	 * A bounded set of chaos game samples for one genome.  The samples are
+	 * kept in flame coordinates, so they don't depend on the camera.  A pan,
+	 * zoom, or rotation of the genome only has to project the kept samples
+	 * through the new camera and bin them, which is much faster than
+	 * iterating the genome again.  The binned buckets are kept too, so an
+	 * edit of the gamma, brightness, contrast, vibrancy, highlight power, or
+	 * background only has to tone map them again.  In the optional color
+	 * histogram mode the samples are also counted by pixel and quantized
+	 * color index, so a new palette is applied by looking up the palette for
+	 * each bin of each pixel, without binning the samples again.  The shape
+	 * key covers every genome field that changes the attractor, and the
+	 * samples are dropped when it changes.  Clouds of the same shape, made
+	 * for different images of a genome, can share their samples.  The shared
+	 * samples only feed the early feedback images; the full renders of each
+	 * image iterate the genome on their own.
+	 */
+	class PointCloud
+	{
+		public:
+			PointCloud();
+			static QByteArray shapeKey(const flam3_genome*);
+			bool sameShape(const flam3_genome*) const;
+			bool sameCamera(const flam3_genome*) const;
+			bool sameTone(const flam3_genome*) const;
+			bool samePalette(const flam3_genome*) const;
+			void setColorHistogram(bool);
+			void reset(const flam3_genome*);
+			void setView(const flam3_genome*);
+			bool isFull() const;
+			int size() const;
+			int iterate(const flam3_genome*, randctx*, volatile bool*);
+			int share(const PointCloud&);
+			void render(const flam3_genome*, QImage&, bool);
+
+		private:
+			struct Sample
+			{
+				float x, y, color, opacity;
+			};
+
+			struct Camera
+			{
+				double center[2];
+				double rot_center[2];
+				double rotate;
+				double pixels_per_unit;
+				double zoom;
+				int width;
+				int height;
+			};
+
+			struct Tone
+			{
+				double contrast;
+				double brightness;
+				double gamma;
+				double vibrancy;
+				double gam_lin_thresh;
+				double highlight_power;
+				double background[3];
+			};
+
+			QByteArray shape;
+			Camera camera;
+			Tone tone;
+			QByteArray palette;
+			QVector<Sample> samples;
+			int capacity;
+			QVector<float> buckets;
+			Camera binned;
+			int binned_samples;
+			QByteArray binned_palette;
+			bool color_histogram;
+			QVector<float> histogram;
+
+			static Camera cameraOf(const flam3_genome*);
+			static Tone toneOf(const flam3_genome*);
+			static QByteArray paletteOf(const flam3_genome*);
+			void bin(const flam3_genome*);
+			void recolor(const flam3_genome*);
+			void toneMap(const flam3_genome*, QImage&, bool) const;
+	};
+}
+
+#endif // POINTCLOUD_H
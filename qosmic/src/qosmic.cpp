@@ -22,11 +22,14 @@
 #include <QTranslator>
 #include <QFileInfo>
 #include <QLibraryInfo>
+#include <QScopedPointer>
 #include <QDebug>
 
 #include "qosmic.h"
 #include "logger.h"
 #include "mainwindow.h"
+#include "batchrenderer.h"
+#include "selftest.h"
 
 using namespace Util;
 
@@ -36,19 +39,32 @@ int main(int argc, char* argv[])
 	QCoreApplication::setOrganizationName("qosmic");
 	QCoreApplication::setApplicationName("qosmic");
 
-	QApplication app(argc, argv);
-	app.setWindowIcon(QIcon(":icons/qosmic.xpm"));
+	// the batch renderer, self test and benchmark don't need the widgets
+	bool batch = argc > 1 && QString(argv[1]) == "--batch";
+	bool selftest = argc > 1 && QString(argv[1]) == "--selftest";
+	bool benchmark = argc > 1 && QString(argv[1]) == "--benchmark";
+	QScopedPointer<QCoreApplication> app;
+	if (batch || selftest || benchmark)
+		app.reset(new QCoreApplication(argc, argv));
+	else
+	{
+		app.reset(new QApplication(argc, argv));
+		qApp->setWindowIcon(QIcon(":icons/qosmic.xpm"));
+	}
 
 	// Initialize the logger
 	Logger::getInstance()->setLevel(Logger::levelFor(getenv("log")));
 	logInfo(QString("main() : Qosmic (version %1)").arg(QOSMIC_VERSION));
 
+	// fix the seed of the random number streams, and log it
+	Util::master_seed();
+
 	// Load translations if necessary
 
     QTranslator translator;
     QString locale = QLocale::system().name();
     translator.load(QString(":ts/qosmic_") + locale);
-    app.installTranslator(&translator);
+    app->installTranslator(&translator);
 
 
 QTranslator qttranslator;
@@ -63,7 +79,7 @@ QTranslator qttranslator;
 		if (qttranslator.load(qmFile, qmDir))
 		{
 			logInfo(QString("main() : installing qt translations for %1").arg(locale));
-			app.installTranslator(&qttranslator);
+			app->installTranslator(&qttranslator);
 		}
 		else
 		{
@@ -112,22 +128,45 @@ QTranslator qttranslator;
 			QString(argv[1]).contains(QRegExp("--?(?:help|h|ver).*")))
 	{
 		cout << QString(QCoreApplication::translate("CoreApp", "Qosmic %1\n"
-			"Usage: qosmic [flam3 file]\n\n"
+			"Usage: qosmic [flam3 file]\n"
+			"       qosmic --batch [options] file.flam3 [file.flam3 ...]\n"
+			"       qosmic --selftest\n"
+			"       qosmic --benchmark\n\n"
 			"environment variables:\n"
 			"log=%2\n"
 			"flam3_verbose=%3\n"
 			"flam3_nthreads=%4\n"
-			"flam3_palettes=%5"))
+			"flam3_palettes=%5\n"
+			"qosmic_nworkers=%6\n"
+			"qosmic_trace=%7\n"
+			"qosmic_seed=%8"))
 			.arg(QOSMIC_VERSION)
 			.arg(Logger::getInstance()->level())
 			.arg(QString(getenv("flam3_verbose")).toInt())
 			.arg(QString(getenv("flam3_nthreads")).toInt() > 0 ?
 				QString(getenv("flam3_nthreads")).toInt() : flam3_count_nthreads())
 			.arg(getenv("flam3_palettes"))
+			.arg(getenv("qosmic_nworkers"))
+			.arg(getenv("qosmic_trace"))
+			.arg(getenv("qosmic_seed"))
 			<< endl;
 		return 0;
 	}
 
+	if (selftest)
+		return Util::selftest() > 0 ? 1 : 0;
+
+	if (benchmark)
+		return Util::benchmark();
+
+	if (batch)
+	{
+		BatchRenderer renderer;
+		if (!renderer.parseArguments(app->arguments()))
+			return 1;
+		return renderer.exec();
+	}
+
 	MainWindow* mw = new MainWindow();
 	QString fname(QOSMIC_AUTOSAVE);
 	if (argc > 1)
@@ -150,7 +189,7 @@ QTranslator qttranslator;
 
 	mw->show();
 	logInfo("main() : qosmic started");
-	return app.exec();
+	return app->exec();
 }
 
 
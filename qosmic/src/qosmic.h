@@ -45,6 +45,7 @@ static const QString QOSMIC_TRANSDIR( TRANSDIR );
 static const QString QOSMIC_SCRIPTSDIR( SCRIPTSDIR );
 static const QString QOSMIC_USERDIR( QDir::home().absoluteFilePath(".qosmic") );
 static const QString QOSMIC_AUTOSAVE( QOSMIC_USERDIR + "/autosave.flam3" );
+static const QString QOSMIC_THUMBNAILDIR( QOSMIC_USERDIR + "/thumbnails" );
 
 static const QString DEFAULT_FLAME_XML(
 "<flame time=\"0\" palette=\"27\" size=\"1280 960\" center=\"0.0 0.0\" "
@@ -18,79 +18,669 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include <QFileInfo>
+#include <QVector>
+#include <QSettings>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <cmath>
 
 #include "renderthread.h"
 #include "flam3util.h"
+#include "imageconvert.h"
+#include "pngwriter.h"
 #include "logger.h"
 #include <QDebug>
 
 
-// global 'static' vars used in callback. they're prefixed with an underscore.
-bool   RenderThread::_stop_current_job = false;
-double RenderThread::_est_remain;
-double RenderThread::_percent_finished;
-stat_struct RenderThread::_stats;
-
 // singleton instance
 RenderThread* RenderThread::singleInstance = 0;
 
+// the number of finished requests kept for the metrics panel
+#define TIMING_LOG_SIZE 64
+
+// the flam3 bucket and accumulator bytes for each oversampled pixel, used
+// to decide when a File request is rendered in tiles.
+#define TILE_BUCKET_BYTES 64
+
+// the smallest tile edge in pixels
+#define TILE_MIN_EDGE 256
+
+// the clock used to stamp request timings
+static QElapsedTimer render_clock;
+
+static const char* request_type_names[] = { "preview", "image", "file", "queued" };
+
 
-QTime RenderThread::ptimer;
 /**
  * this callback is needed to control the rendering function.  it also
- * helps calculate the estimated time remaining.
+ * helps calculate the estimated time remaining.  the parameter is the
+ * RenderWorker that called flam3_render().
 */
-int RenderThread::_progress_callback(
-        void* /*parameter*/, double /*vari*/, int /*varn*/, double est)
+int RenderWorker::_progress_callback(
+        void* parameter, double /*vari*/, int /*varn*/, double est)
 {
+    RenderWorker* w = static_cast<RenderWorker*>(parameter);
     if (est != 0.0)
     {
-        double elapsed = ptimer.elapsed() ;
-        _est_remain = est * 1000.0;
-        _percent_finished = elapsed / (_est_remain + elapsed) * 100.0;
+        // tiled renders call flam3_render() once for each tile
+        double elapsed = w->ptimer.elapsed() - w->tile_start;
+        double tile = elapsed / (est * 1000.0 + elapsed);
+        double done = (w->tiles_done + tile) / w->tiles_total;
+        w->percent_finished = done * 100.0;
+        w->est_remain = done > 0.0 ?
+                w->ptimer.elapsed() * (1.0 - done) / done : 0.0;
     }
 
-    if (_stop_current_job)
+    if (w->stop_job)
         return 1;
 
     return 0;
 }
 
-void RenderThread::init_status_cb()
-{
-    _est_remain = 0.0;
-    _percent_finished = 0.0;
-}
-
-RenderThread::RenderThread() :
+RenderWorker::RenderWorker(RenderThread* t, int id) :
+    rthread(t),
+    worker_id(id),
+    job(0),
+    job_genomes(0),
+    stop_job(false),
+    kill_job(false),
     rendering(false),
-    kill_all_jobs(false),
+    est_remain(0.0),
+    percent_finished(0.0),
     millis(0),
+    tiles_done(0),
+    tiles_total(1),
+    tile_start(0),
     running(true)
 {
     // stuff to control the flam3_render function
-    render_loop_flag  = false;
-    setFormat(RGB32);
-
     flam3_init_frame(&flame);
     flame.progress = &_progress_callback;
+    flame.progress_parameter = this;
     flame.bits = 64;
     flame.ngenomes = 1; // only render one genome
     flame.time = 0.0;
     flame.bytes_per_channel = 1;
     flame.pixel_aspect_ratio = 1.0;
     flame.sub_batch_size = 10000;
-    flame.nthreads = QString(getenv("flam3_nthreads")).toInt();
+    flame.nthreads = 1;
     flame.verbose  = QString(getenv("flam3_verbose")).toInt();
     flame.earlyclip = 0;
+    // flam3_render() seeds its threads from the frame's isaac context
+    Util::init_randctx(&flame.rc, Util::next_stream());
+}
 
-    if (flame.nthreads < 1)
-        flame.nthreads = flam3_count_nthreads();
+RenderWorker::~RenderWorker()
+{
+}
 
-    logInfo(QString("RenderThread::RenderThread : using %1 rendering thread(s)").arg(flame.nthreads));
+void RenderWorker::start()
+{
+    running = true;
+    QThread::start();
+}
 
-    preview_request = 0;
-    image_request = 0;
+void RenderWorker::stop()
+{
+    running = false;
+    stopRendering();
+    job_ready.wakeAll();
+}
+
+void RenderWorker::run()
+{
+    logInfo("RenderWorker::run : starting worker %d", worker_id);
+    while (running)
+    {
+        job_mutex.lock();
+        if (job_genomes == 0)
+            job_ready.wait(&job_mutex, 100);
+        RenderRequest* req = job;
+        flam3_genome* genomes = job_genomes;
+        job_mutex.unlock();
+        if (genomes == 0)
+            continue;
+
+        renderJob(req, genomes);
+
+        job_mutex.lock();
+        job = 0;
+        job_genomes = 0;
+        job_mutex.unlock();
+
+        // let the scheduler know this worker is free
+        rthread->rqueue_wait.wakeAll();
+    }
+    logInfo("RenderWorker::run : worker %d exiting", worker_id);
+}
+
+/**
+ * Hand a request to this worker.  The genomes have already been copied and
+ * prepared by the RenderThread, and they are freed by the worker.
+ */
+void RenderWorker::render(RenderRequest* req, flam3_genome* genomes,
+                          int ngenomes, int nthreads, const QByteArray& key)
+{
+    QMutexLocker locker(&job_mutex);
+    job = req;
+    job_genomes = genomes;
+    job_key = key;
+    flame.genomes = genomes;
+    flame.ngenomes = ngenomes;
+    flame.time = req->time();
+    flame.nthreads = nthreads;
+    stop_job = false;
+    kill_job = false;
+    job_ready.wakeAll();
+}
+
+/**
+ * The edge of the square tiles that a File request is split into so that
+ * the flam3 buckets for each tile fit in the memory budget, or zero if the
+ * whole image fits.  The tile margin needed by the filters is returned in
+ * margin.
+ */
+static int tile_edge(const flam3_genome* g, qint64 budget, int* margin)
+{
+    if (budget <= 0)
+        return 0;
+
+    qint64 os = qMax(1, g->spatial_oversample);
+    qint64 pixel_bytes = os * os * TILE_BUCKET_BYTES;
+    if ((qint64)g->width * g->height * pixel_bytes <= budget)
+        return 0;
+
+    *margin = (int)ceil(g->spatial_filter_radius + g->estimator) + 1;
+    int edge = (int)sqrt((double)(budget / pixel_bytes)) - 2 * *margin;
+    return qMax(TILE_MIN_EDGE, edge);
+}
+
+/**
+ * Set the image size and quality of the genomes for a progressive pass.
+ * Each level halves the image size and the sample density of the full
+ * quality genomes, and level zero restores them.
+ */
+static void set_pass_quality(flam3_genome* genomes, const flam3_genome* full,
+                             int ngenomes, int level)
+{
+    int div = 1 << level;
+    for (int n = 0 ; n < ngenomes ; n++)
+    {
+        flam3_genome* g = genomes + n;
+        const flam3_genome* f = full + n;
+        g->width  = qMax(1, f->width / div);
+        g->height = qMax(1, f->height / div);
+        g->pixels_per_unit   = f->pixels_per_unit * g->width / f->width;
+        g->sample_density    = f->sample_density / div;
+        g->spatial_oversample = level > 0 ? 1 : f->spatial_oversample;
+        g->nbatches          = level > 0 ? 1 : f->nbatches;
+        g->ntemporal_samples = level > 0 ? 1 : f->ntemporal_samples;
+        g->estimator         = level > 0 ? 0.0 : f->estimator;
+    }
+}
+
+void RenderWorker::renderJob(RenderRequest* job, flam3_genome* genomes)
+{
+    logFiner(QString("RenderWorker::renderJob : worker %1 rendering request 0x%2")
+            .arg(worker_id).arg((long)job,0,16));
+    if (job->type() == RenderRequest::File)
+        rtype = QFileInfo(job->name()).fileName();
+    else
+        rtype = job->name();
+
+    job->setError(QString());
+    tiles_done = 0;
+    tiles_total = 1;
+    tile_start = 0;
+    int margin = 0;
+    int edge = 0;
+    if (job->type() == RenderRequest::File)
+        edge = tile_edge(genomes, rthread->tile_memory, &margin);
+
+    if (edge > 0)
+        renderTiles(job, genomes, edge, margin);
+    else
+        renderPasses(job, genomes);
+
+    for (int n = 0 ; n < flame.ngenomes ; n++)
+        clear_cp(genomes + n, flam3_defaults_off);
+    delete[] genomes;
+
+    if (stop_job)
+    {
+        logFine(QString("RenderWorker::renderJob : %1 rendering stopped").arg(rtype));
+        if (!kill_job && job->type() == RenderRequest::Queued)
+        {
+            logFine("RenderWorker::renderJob : re-adding queued request");
+            rthread->requeue(job);
+        }
+        return;
+    }
+    logFiner(QString("RenderWorker::renderJob : finished"));
+}
+
+/**
+ * Render a request in one piece, possibly in several progressive passes.
+ */
+void RenderWorker::renderPasses(RenderRequest* job, flam3_genome* genomes)
+{
+    // the output format is shared by all of the workers
+    RenderThread::ImageFormat img_format = rthread->img_format;
+    int channels = rthread->channels;
+    int alpha_trans = rthread->alpha_trans;
+    flame.earlyclip = rthread->early_clip;
+
+    QSize buf_size(genomes->width, genomes->height);
+    int msize = channels * genomes->width * genomes->height;
+    unsigned char* out = new unsigned char[msize];
+    logFine("RenderWorker::renderPasses : allocated %d bytes, rendering...", msize);
+
+    // camera and tone edits are first drawn from the kept samples.  The
+    // preview and the viewer share these samples, but the full passes below
+    // still run for each of them.
+    if ((job->type() == RenderRequest::Preview
+         || job->type() == RenderRequest::Image) && flame.ngenomes == 1)
+        renderCloudPass(job, genomes);
+
+    // progressive requests are first rendered at lower sizes and densities
+    int npasses = qMax(1, job->passes());
+    QVector<flam3_genome> full;
+    if (npasses > 1)
+        for (int n = 0 ; n < flame.ngenomes ; n++)
+            full.append(genomes[n]);
+
+    for (int level = npasses - 1 ; level >= 0 && !stop_job ; level--)
+    {
+        if (npasses > 1)
+            set_pass_quality(genomes, full.constData(), flame.ngenomes, level);
+        QSize pass_size(genomes->width, genomes->height);
+
+        est_remain = 0.0;
+        percent_finished = 0.0;
+        int rv = 1;
+        ptimer.start();
+        if (!stop_job)
+        {
+            qint64 start = RenderThread::clock();
+            rendering = true;
+            rv = flam3_render(&flame, out, 0, channels, alpha_trans, &stats);
+            rendering = false;
+            job->addRenderTime(RenderThread::clock() - start, stats.num_iters);
+            job->stamp(RenderRequest::Times::Rendered);
+        }
+        millis = ptimer.elapsed();
+
+        if (stop_job) // if stopRendering() is called
+            break;
+
+        // the previous image is still shared with a request, so writing into
+        // it would only detach a copy that is overwritten anyway.
+        qint64 start = RenderThread::clock();
+        img_buf = QImage(pass_size, img_format == RenderThread::RGB32 ?
+                QImage::Format_RGB32 : QImage::Format_ARGB32);
+        if (rv == 0)
+        {
+            QTime ctimer;
+            ctimer.start();
+            Util::convert_image(out, channels, img_buf);
+            logFine("RenderWorker::renderPasses : converted %dx%d image in %d ms (%s)",
+                    pass_size.width(), pass_size.height(), ctimer.elapsed(),
+                    Util::convert_image_kernel());
+        }
+        else
+        {
+            logError(QString("RenderWorker::renderPasses : flam3_render failed for %1")
+                    .arg(rtype));
+            job->setError(QString("flam3_render failed"));
+            img_buf.fill(0);
+        }
+
+        if (pass_size != buf_size)
+        {
+            logFine("RenderWorker::renderPasses : pass %d of %d rendered in %d ms",
+                    npasses - level, npasses, millis);
+            img_buf = img_buf.scaled(buf_size, Qt::IgnoreAspectRatio,
+                                     Qt::SmoothTransformation);
+        }
+        job->addConvertTime(RenderThread::clock() - start);
+        job->stamp(RenderRequest::Times::Converted);
+
+        if (job->type() == RenderRequest::File && rv == 0)
+        {
+            if (!img_buf.save(job->name(), "png", 100))
+            {
+                logError(QString("RenderWorker::renderPasses : couldn't write %1")
+                        .arg(job->name()));
+                job->setError(QString("couldn't write %1").arg(job->name()));
+            }
+            job->stamp(RenderRequest::Times::Saved);
+        }
+
+        if (level == 0 && rv == 0)
+            rthread->cacheImage(job_key, img_buf);
+
+        job->setImage(img_buf);
+        job->setStats(stats);
+        job->setPass(npasses - level);
+        job->setFinished(level == 0 || rv != 0);
+        rthread->jobFinished(this, job);
+        if (rv != 0)
+            break;
+    }
+    delete[] out;
+}
+
+/**
+ * Emit an image projected from the chaos game samples of an earlier image
+ * of the request, if the genome only differs from it by its camera, its
+ * tone mapping, or its palette.  The samples are iterated once, the first
+ * time the genome is edited that way, and each following pan, zoom, or
+ * rotation is projected in a few milliseconds.  Tone mapping and palette
+ * edits reuse the binned samples as well.  Any other change to the genome
+ * drops the samples.  The preview and the viewer share the samples of the
+ * same genome, so this early pass runs the chaos game once for both of them.
+ * Only this pass is shared.  The full flam3_render() passes that follow it
+ * still iterate the genome for each target, because flam3 accumulates one
+ * camera per call.
+ */
+void RenderWorker::renderCloudPass(RenderRequest* job, flam3_genome* genomes)
+{
+    QMutexLocker locker(&rthread->cloud_mutex);
+    bool preview = job->type() == RenderRequest::Preview;
+    Util::PointCloud& cloud = preview ? rthread->preview_cloud : rthread->image_cloud;
+    Util::PointCloud& other = preview ? rthread->image_cloud : rthread->preview_cloud;
+    if (!cloud.sameShape(genomes))
+    {
+        cloud.reset(genomes);
+        cloud.share(other);
+        return;
+    }
+    if (cloud.sameCamera(genomes) && cloud.sameTone(genomes)
+        && cloud.samePalette(genomes))
+        return;
+
+    qint64 start = RenderThread::clock();
+    // the preview and the viewer usually show the same genome, so the
+    // samples iterated for one of them are binned for the other as well
+    if (!cloud.isFull() && cloud.share(other) == 0)
+    {
+        rendering = true;
+        int added = cloud.iterate(genomes, &flame.rc, &stop_job);
+        rendering = false;
+        job->addRenderTime(0, added);
+    }
+    if (stop_job || cloud.size() == 0)
+        return;
+    cloud.setView(genomes);
+
+    RenderThread::ImageFormat img_format = rthread->img_format;
+    QImage img(genomes->width, genomes->height,
+            img_format == RenderThread::RGB32 ?
+            QImage::Format_RGB32 : QImage::Format_ARGB32);
+    cloud.render(genomes, img, img_format == RenderThread::ARGB32_TRANS);
+    qint64 elapsed = RenderThread::clock() - start;
+    job->addRenderTime(elapsed);
+    job->stamp(RenderRequest::Times::Rendered);
+    logFine("RenderWorker::renderCloudPass : drew %d samples in %d ms",
+            cloud.size(), (int)(elapsed / 1000));
+    locker.unlock();
+
+    job->setImage(img);
+    job->setPass(0);
+    job->setFinished(false);
+    rthread->jobFinished(this, job);
+}
+
+/**
+ * Render a large File request as a grid of square tiles, and stream them
+ * into the png a band of tiles at a time.  Each tile is rendered with the
+ * same genomes, with the camera moved over the tile and its margins.  The
+ * margins are wide enough for the spatial and density estimation filters,
+ * so they are cropped away and the tiles join without seams.  The memory
+ * used is bounded by the tile size and one band of output rows.
+ */
+void RenderWorker::renderTiles(RenderRequest* job, flam3_genome* genomes,
+                               int edge, int margin)
+{
+    int channels = rthread->channels;
+    int alpha_trans = rthread->alpha_trans;
+    flame.earlyclip = rthread->early_clip;
+
+    const int width  = genomes->width;
+    const int height = genomes->height;
+    const int cols = (width  + edge - 1) / edge;
+    const int rows = (height + edge - 1) / edge;
+    logInfo(QString("RenderWorker::renderTiles : rendering %1x%2 image as %3x%4 tiles of %5 pixels")
+            .arg(width).arg(height).arg(cols).arg(rows).arg(edge));
+
+    // the camera and the sample density of the full image
+    QVector<double> cx, cy, scale, density;
+    for (int n = 0 ; n < flame.ngenomes ; n++)
+    {
+        cx << genomes[n].center[0];
+        cy << genomes[n].center[1];
+        scale << genomes[n].pixels_per_unit * pow(2.0, genomes[n].zoom);
+        density << genomes[n].sample_density;
+    }
+
+    Util::PngWriter writer;
+    bool ok = writer.open(job->name(), width, height, channels);
+    const int out_edge = edge + 2 * margin;
+    unsigned char* out = 0;
+    QByteArray band;
+    if (ok)
+    {
+        out = new unsigned char[channels * out_edge * out_edge];
+        band.resize(channels * width * edge);
+    }
+
+    stat_struct total = stat_struct();
+    tiles_total = rows * cols;
+    tiles_done = 0;
+    ptimer.start();
+    for (int row = 0 ; row < rows && ok && !stop_job ; row++)
+    {
+        const int y0 = row * edge;
+        const int th = qMin(edge, height - y0);
+        for (int col = 0 ; col < cols && ok && !stop_job ; col++)
+        {
+            const int x0 = col * edge;
+            const int tw = qMin(edge, width - x0);
+            const int rw = tw + 2 * margin;
+            const int rh = th + 2 * margin;
+
+            // offset of the tile center from the image center in pixels
+            double dx = x0 - margin + rw / 2.0 - width  / 2.0;
+            double dy = y0 - margin + rh / 2.0 - height / 2.0;
+
+            // flam3 iterates in proportion to the tile's area, and only that
+            // share of the samples lands in the tile, so the density is raised
+            // to give each tile the quality of the full image.
+            double density_scale = (double)width * height / ((double)rw * rh);
+            for (int n = 0 ; n < flame.ngenomes ; n++)
+            {
+                flam3_genome* g = genomes + n;
+                g->width  = rw;
+                g->height = rh;
+                g->center[0] = cx[n] + dx / scale[n];
+                g->center[1] = cy[n] + dy / scale[n];
+                g->sample_density = density[n] * density_scale;
+            }
+
+            tile_start = ptimer.elapsed();
+            qint64 start = RenderThread::clock();
+            rendering = true;
+            int rv = flam3_render(&flame, out, 0, channels, alpha_trans, &stats);
+            rendering = false;
+            job->addRenderTime(RenderThread::clock() - start, stats.num_iters);
+            total.num_iters += stats.num_iters;
+            total.badvals += stats.badvals;
+            total.render_seconds += stats.render_seconds;
+            if (stop_job)
+                break;
+            if (rv != 0)
+            {
+                logError(QString("RenderWorker::renderTiles : tile %1,%2 failed")
+                        .arg(col).arg(row));
+                ok = false;
+                break;
+            }
+
+            // crop the margins and copy the tile into the band
+            start = RenderThread::clock();
+            for (int y = 0 ; y < th ; y++)
+                memcpy(band.data() + (y * width + x0) * channels,
+                       out + ((y + margin) * rw + margin) * channels,
+                       tw * channels);
+            job->addConvertTime(RenderThread::clock() - start);
+            tiles_done++;
+        }
+
+        for (int y = 0 ; y < th && ok && !stop_job ; y++)
+            ok = writer.writeRow(reinterpret_cast<const unsigned char*>(
+                        band.constData()) + y * width * channels);
+    }
+    millis = ptimer.elapsed();
+    delete[] out;
+    for (int n = 0 ; n < flame.ngenomes ; n++)
+    {
+        flam3_genome* g = genomes + n;
+        g->width  = width;
+        g->height = height;
+        g->center[0] = cx[n];
+        g->center[1] = cy[n];
+        g->sample_density = density[n];
+    }
+    job->stamp(RenderRequest::Times::Rendered);
+    job->stamp(RenderRequest::Times::Converted);
+
+    if (!writer.close() && !stop_job)
+        ok = false;
+    if (!ok || stop_job)
+    {
+        if (!ok)
+        {
+            logError(QString("RenderWorker::renderTiles : couldn't write %1 : %2")
+                    .arg(job->name()).arg(writer.errorString()));
+            job->setError(writer.errorString().isEmpty() ?
+                    QString("couldn't render %1").arg(job->name()) :
+                    QString("couldn't write %1 : %2").arg(job->name())
+                    .arg(writer.errorString()));
+        }
+        QFile::remove(job->name());
+    }
+    if (stop_job)
+        return;
+    job->stamp(RenderRequest::Times::Saved);
+
+    // the full image is never held in memory, so there's nothing to show
+    QImage none;
+    job->setImage(none);
+    job->setStats(total);
+    job->setPass(job->passes());
+    job->setFinished(true);
+    rthread->jobFinished(this, job);
+}
+
+RenderRequest* RenderWorker::current() const
+{
+    QMutexLocker locker(&job_mutex);
+    return job;
+}
+
+bool RenderWorker::isRendering() const
+{
+    return rendering;
+}
+
+/**
+ * stop the current job.  a stopped Queued request is given back to the
+ * RenderThread.
+ */
+void RenderWorker::stopRendering()
+{
+    QMutexLocker locker(&job_mutex);
+    if (job)
+        stop_job = true;
+}
+
+/**
+ * stop the current job and drop the request.
+ */
+void RenderWorker::kill()
+{
+    QMutexLocker locker(&job_mutex);
+    if (job)
+    {
+        kill_job = true;
+        stop_job = true;
+    }
+}
+
+double RenderWorker::estRemain() const
+{
+    return est_remain;
+}
+
+double RenderWorker::finished() const
+{
+    return percent_finished;
+}
+
+int RenderWorker::runtime() const
+{
+    return millis;
+}
+
+QString RenderWorker::name() const
+{
+    return rtype;
+}
+
+
+RenderThread::RenderThread() :
+    preview_request(0),
+    image_request(0),
+    kill_all_jobs(false),
+    file_finished(false),
+    early_clip(0),
+    millis(0),
+    tile_memory(0),
+    running(true)
+{
+    render_clock.start();
+    setFormat(RGB32);
+
+    nthreads = QString(getenv("flam3_nthreads")).toInt();
+    if (nthreads < 1)
+        nthreads = flam3_count_nthreads();
+
+    // small requests scale poorly across many threads, so by default share
+    // the flam3 threads between a few workers.
+    int nworkers = QString(getenv("qosmic_nworkers")).toInt();
+    if (nworkers < 1)
+        nworkers = qBound(1, nthreads / 2, 4);
+
+    logInfo(QString("RenderThread::RenderThread : using %1 rendering thread(s) and %2 worker(s)")
+            .arg(nthreads).arg(nworkers));
+
+    for (int n = 0 ; n < nworkers ; n++)
+        workers.append(new RenderWorker(this, n));
+
+    // the preview is small enough to recolor from a color histogram
+    preview_cloud.setColorHistogram(true);
+
+    QSettings settings;
+    settings.beginGroup("renderthread");
+    setCacheSize(settings.value("cachesize", 64 * 1024 * 1024).toInt());
+    setTileMemory(settings.value("tilememory", 2048).toInt());
+    settings.endGroup();
+
+    trace_json = false;
+    QString trace_path(getenv("qosmic_trace"));
+    if (!trace_path.isEmpty())
+        openTrace(trace_path);
 
     so = new StatusObserver(this);
     so->start();
@@ -108,262 +698,438 @@ RenderThread* RenderThread::getInstance()
 RenderThread::~RenderThread()
 {
     running = false;
+    wait();
+    foreach (RenderWorker* w, workers)
+    {
+        w->stop();
+        w->wait();
+        delete w;
+    }
     so->running = false;
+    so->wait();
     delete so;
 }
 
 void RenderThread::run()
 {
     logInfo("RenderThread::run : starting thread");
+    foreach (RenderWorker* w, workers)
+        w->start();
+
     while (running)
     {
         running_mutex.lock();
-        RenderRequest* job;
-        if (preview_request != 0)
+        rqueue_mutex.lock();
+        RenderWorker* worker = 0;
+        int job_nthreads = nthreads;
+        RenderRequest* job = nextRequest(&worker, &job_nthreads);
+        if (job == 0)
+        {
+            running_mutex.unlock();
+            // sleep until a request is submitted or a worker is free
+            rqueue_wait.wait(&rqueue_mutex, 100);
+            rqueue_mutex.unlock();
+            continue;
+        }
+
+        logFine("RenderThread::run : dispatching request %#x", (long)job);
+        job->stamp(RenderRequest::Times::Dequeued);
+        kill_all_jobs = false;
+        int ngenomes = 0;
+        flam3_genome* genomes = prepareGenomes(job, &ngenomes);
+        job->stamp(RenderRequest::Times::Copied);
+        job->setGeneration(generations.value(job->genome()));
+        if (genomes)
+        {
+            // files aren't cached, they're usually large and rendered once
+            QByteArray key;
+            if (job->type() != RenderRequest::File)
+                key = cacheKey(job);
+            job->setKey(key);
+            worker->render(job, genomes, ngenomes, job_nthreads, key);
+        }
+        rqueue_mutex.unlock();
+        running_mutex.unlock();
+    }
+
+    foreach (RenderWorker* w, workers)
+        w->stop();
+    foreach (RenderWorker* w, workers)
+        w->wait();
+    logInfo("RenderThread::run : thread exiting");
+}
+
+/**
+ * Select the next request and an idle worker for it.  Previews, images, and
+ * files wait for every worker to be idle so that they get all of the
+ * threads.  Queued requests are spread over the idle workers, but only while
+ * no larger request is running or waiting.  rqueue_mutex must be held.
+ */
+RenderRequest* RenderThread::nextRequest(RenderWorker** worker, int* job_nthreads)
+{
+    RenderWorker* idle = 0;
+    int busy = 0;
+    bool large_job_running = false;
+    foreach (RenderWorker* w, workers)
+    {
+        RenderRequest* r = w->current();
+        if (r == 0)
+        {
+            if (idle == 0)
+                idle = w;
+        }
+        else
+        {
+            busy++;
+            if (r->type() != RenderRequest::Queued)
+                large_job_running = true;
+        }
+    }
+    if (idle == 0 || large_job_running)
+        return 0;
+
+    RenderRequest* job = 0;
+    *worker = idle;
+    *job_nthreads = nthreads;
+    if (preview_request != 0)
+    {
+        if (busy == 0)
         {
             job = preview_request;
             preview_request = 0;
         }
-        else if (image_request != 0)
+    }
+    else if (image_request != 0)
+    {
+        if (busy == 0)
         {
             job = image_request;
             image_request = 0;
         }
-        else
-        {
-            rqueue_mutex.lock();
-            if (request_queue.isEmpty())
-            {
-                // sleep only after checking for requests
-                current_request = 0;
-                rqueue_mutex.unlock();
-                running_mutex.unlock();
-                usleep(10000);
-                continue;
-            }
-            else
-            {
-                job = request_queue.dequeue();
-                logFine("RenderThread::run : dequeueing request %#x", (long)job);
-                rqueue_mutex.unlock();
-            }
-        }
-        render_loop_flag = true;
-        current_request = job;
-
-        // make sure there is something to calculate
-        bool no_pos_xf = true;
-        for (flam3_xform* xf = job->genome()->xform ;
-             xf < job->genome()->xform + job->genome()->num_xforms ; xf++)
-            if (xf->density > 0.0)
-            {
-                no_pos_xf = false;
-                break;
-            }
-        if (no_pos_xf)
+    }
+    else if (!request_queue.isEmpty())
+    {
+        if (request_queue.head()->type() == RenderRequest::Queued)
         {
-            logWarn(QString("RenderThread::run : no xform in request 0x%1").arg((long)job,0,16));
-            running_mutex.unlock();
-            continue;
+            job = request_queue.dequeue();
+            *job_nthreads = qMax(1, nthreads / workers.size());
         }
+        else if (busy == 0)
+            job = request_queue.dequeue();
+        if (job)
+            queued.remove(job);
+    }
+    return job;
+}
 
-        logFiner(QString("RenderThread::run : rendering request 0x%1").arg((long)job,0,16));
-        rtype = job->name();
-        flame.time = job->time();
-        flame.ngenomes = job->numGenomes();
-        flam3_genome* genomes = new flam3_genome[flame.ngenomes]();
-        flam3_genome* job_genome = job->genome();
-        for (int n = 0 ; n < flame.ngenomes ; n++)
-            flam3_copy(genomes + n, job_genome + n);
-        flame.genomes = genomes;
-        QSize imgSize(job->size());
-        if (!imgSize.isEmpty())
+/**
+ * Find the control points that flam3_render() reads for a frame at time t.
+ * The temporal samples cover the temporal filter width around t, and smooth
+ * interpolation reads two more control points on each side.  The control
+ * points must be sorted by time, as flam3_interpolate() requires.
+ */
+static void control_point_window(flam3_genome* cps, int ncps, double t,
+                                 int* first, int* count)
+{
+    double width = qMax(1.0, cps->temporal_filter_width);
+
+    // the first control point at or after t - width
+    int lo = 0, hi = ncps;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (cps[mid].time < t - width)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int begin = lo;
+
+    // the first control point after t + width
+    hi = ncps;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (cps[mid].time <= t + width)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int end = lo;
+
+    *first = qMax(0, begin - 2);
+    *count = qMin(ncps, end + 2) - *first;
+}
+
+/**
+ * Copy the genomes for a request, and apply the size and quality presets.
+ * This is called with the running_mutex held since the clients' genomes
+ * are read here.  Returns 0 if there is nothing to render.
+ */
+flam3_genome* RenderThread::prepareGenomes(RenderRequest* job, int* ngenomes)
+{
+    // make sure there is something to calculate
+    bool no_pos_xf = true;
+    for (flam3_xform* xf = job->genome()->xform ;
+         xf < job->genome()->xform + job->genome()->num_xforms ; xf++)
+        if (xf->density > 0.0)
         {
-            for (int n = 0 ; n < flame.ngenomes ; n++)
-            {
-                flam3_genome* genome = genomes + n;
-                // scale images, previews, etc. if necessary
-                int width  = genome->width;
-                genome->width  = imgSize.width();
-                genome->height = imgSize.height();
-
-                // "rescale" the image scale to maintain the camera
-                // for smaller/larger image size
-                genome->pixels_per_unit /= ((double)width) / genome->width;
-            }
+            no_pos_xf = false;
+            break;
         }
+    if (no_pos_xf)
+    {
+        logWarn(QString("RenderThread::prepareGenomes : no xform in request 0x%1").arg((long)job,0,16));
+        return 0;
+    }
 
-        // Load image quality settings for Image, Preview, and File types
-        switch (job->type())
+    // sequences are only copied around the frame being rendered
+    int first = 0;
+    *ngenomes = job->numGenomes();
+    if (*ngenomes > 1)
+    {
+        control_point_window(job->genome(), *ngenomes, job->time(),
+                             &first, ngenomes);
+        logFiner(QString("RenderThread::prepareGenomes : copying genomes %1 to %2 of %3")
+                .arg(first).arg(first + *ngenomes - 1).arg(job->numGenomes()));
+    }
+    flam3_genome* genomes = new flam3_genome[*ngenomes]();
+    flam3_genome* job_genome = job->genome() + first;
+    for (int n = 0 ; n < *ngenomes ; n++)
+        flam3_copy(genomes + n, job_genome + n);
+    QSize imgSize(job->size());
+    if (!imgSize.isEmpty())
+    {
+        for (int n = 0 ; n < *ngenomes ; n++)
         {
-            case RenderRequest::File:
-                rtype = QFileInfo(job->name()).fileName();
-
-            case RenderRequest::Image:
-            case RenderRequest::Preview:
-            case RenderRequest::Queued:
-            {
-                const flam3_genome* g = job->imagePresets();
-                if (g->nbatches > 0) // valid quality settings for nbatches > 0
-                    for (int n = 0 ; n < flame.ngenomes ; n++)
-                    {
-                        flam3_genome* genome = genomes + n;
-                        genome->sample_density =            g->sample_density;
-                        genome->spatial_filter_radius =     g->spatial_filter_radius;
-                        genome->spatial_oversample =        g->spatial_oversample;
-                        genome->nbatches =                  g->nbatches;
-                        genome->ntemporal_samples =         g->ntemporal_samples;
-                        genome->estimator =                 g->estimator;
-                        genome->estimator_curve =           g->estimator_curve;
-                        genome->estimator_minimum =         g->estimator_minimum;
-                    }
-            }
-
-            default:
-                ;
+            flam3_genome* genome = genomes + n;
+            // scale images, previews, etc. if necessary
+            int width  = genome->width;
+            genome->width  = imgSize.width();
+            genome->height = imgSize.height();
+
+            // "rescale" the image scale to maintain the camera
+            // for smaller/larger image size
+            genome->pixels_per_unit /= ((double)width) / genome->width;
         }
+    }
 
-        // add symmetry xforms before rendering
-        for (int n = 0 ; n < flame.ngenomes ; n++)
+    // Load image quality settings for Image, Preview, File, and Queued types
+    const flam3_genome* g = job->imagePresets();
+    if (g->nbatches > 0) // valid quality settings for nbatches > 0
+        for (int n = 0 ; n < *ngenomes ; n++)
         {
             flam3_genome* genome = genomes + n;
-            if (genome->symmetry != 1)
-                flam3_add_symmetry(genome, genome->symmetry);
+            genome->sample_density =            g->sample_density;
+            genome->spatial_filter_radius =     g->spatial_filter_radius;
+            genome->spatial_oversample =        g->spatial_oversample;
+            genome->nbatches =                  g->nbatches;
+            genome->ntemporal_samples =         g->ntemporal_samples;
+            genome->estimator =                 g->estimator;
+            genome->estimator_curve =           g->estimator_curve;
+            genome->estimator_minimum =         g->estimator_minimum;
         }
 
-        int msize = channels * genomes->width * genomes->height;
-        unsigned char* out = new unsigned char[msize];
-        unsigned char* head = out;
-        logFine("RenderThread::run : allocated %d bytes, rendering...", msize);
-        init_status_cb();
-        rendering = true;
-        ptimer.start();
-       int rv = flam3_render(&flame, out, 0, channels, alpha_trans, &_stats);
-        millis = ptimer.elapsed();
-        rendering = false;
-        render_loop_flag = false;
+    // add symmetry xforms before rendering
+    for (int n = 0 ; n < *ngenomes ; n++)
+    {
+        flam3_genome* genome = genomes + n;
+        if (genome->symmetry != 1)
+            flam3_add_symmetry(genome, genome->symmetry);
+    }
 
-        if (_stop_current_job) // if stopRendering() is called
-        {
-            logFine(QString("RenderThread::run : %1 rendering stopped").arg(rtype));
-            delete[] head;
-            for (int n = 0 ; n < flame.ngenomes ; n++)
-                clear_cp(genomes + n, flam3_defaults_off);
-            delete[] genomes;
-            if (kill_all_jobs)
-            {
-                preview_request = 0;
-                image_request = 0;
-                rqueue_mutex.lock();
-                request_queue.clear();
-                rqueue_mutex.unlock();
-                kill_all_jobs = false;
-                emit flameRenderingKilled();
-            }
-            else
-                if (job->type() == RenderRequest::Queued)
-                {
-                    logFine("RenderThread::run : re-adding queued request");
-                    rqueue_mutex.lock();
-                    request_queue.prepend(job);
-                    rqueue_mutex.unlock();
-                }
+    return genomes;
+}
 
-            _stop_current_job = false;
-            running_mutex.unlock();
-            continue;
-        }
+/**
+ * Put a stopped Queued request back at the head of the queue.
+ */
+void RenderThread::requeue(RenderRequest* job)
+{
+    rqueue_mutex.lock();
+    if (!queued.contains(job))
+    {
+        request_queue.prepend(job);
+        queued.insert(job);
+    }
+    rqueue_mutex.unlock();
+    rqueue_wait.wakeAll();
+}
 
-        QSize buf_size(genomes->width, genomes->height);
-        if (img_format == RGB32)
-        {
-            if (buf_size != img_buf.size())
-                img_buf = QImage(buf_size, QImage::Format_RGB32);
-            if (rv == 0)
-            {
-                for (int h = 0 ; h < genomes->height ; h++)
-                    for (int w = 0 ; w < genomes->width ; w++, out += channels)
-                        img_buf.setPixel(QPoint(w, h), qRgb(out[0], out[1], out[2]));
-            }
-            else
-                img_buf.fill(0);
-        }
+/**
+ * Called by a worker once its request has been rendered.
+ */
+void RenderThread::jobFinished(RenderWorker* worker, RenderRequest* job)
+{
+    rqueue_mutex.lock();
+    rtype = worker->name();
+    millis = worker->runtime();
+    if (job->type() == RenderRequest::File)
+        file_finished = true;
+
+    // don't show an image of an edited genome if it's about to be rendered again
+    bool stale = job->generation() < generations.value(job->genome())
+        && (queued.contains(job) || preview_request == job || image_request == job);
+    if (stale)
+        job->setFinished(false);
+    rqueue_mutex.unlock();
+
+    if (stale)
+        logFine("RenderThread::jobFinished : dropping stale image for req %#x", (long)job);
+    else
+        emitRendered(job);
+}
+
+/**
+ * Forget the edit generations of the genomes at [first, first + count).  Call
+ * this before genomes are freed or moved, so the generations table doesn't
+ * grow without bound and a genome stored at a reused address doesn't inherit
+ * an old counter.
+ */
+void RenderThread::forgetGenomes(const flam3_genome* first, int count)
+{
+    if (count <= 0)
+        return;
+    QMutexLocker locker(&rqueue_mutex);
+    quintptr lo = (quintptr)first;
+    quintptr hi = (quintptr)(first + count);
+    QHash<const flam3_genome*, quint64>::iterator i = generations.begin();
+    while (i != generations.end())
+    {
+        quintptr key = (quintptr)i.key();
+        if (lo <= key && key < hi)
+            i = generations.erase(i);
         else
-        {
-            if (buf_size != img_buf.size())
-                img_buf = QImage(buf_size, QImage::Format_ARGB32);
-            if (rv == 0)
-            {
-                for (int h = 0 ; h < genomes->height ; h++)
-                    for (int w = 0 ; w < genomes->width ; w++, out += channels)
-                        img_buf.setPixel(QPoint(w, h), qRgba(out[0], out[1], out[2], out[3]));
-            }
-            else
-                img_buf.fill(0);
-        }
-        delete[] head;
-        for (int n = 0 ; n < flame.ngenomes ; n++)
-            clear_cp(genomes + n, flam3_defaults_off);
-        delete[] genomes;
+            ++i;
+    }
+}
 
-        if (job->type() == RenderRequest::File)
-            img_buf.save(job->name(), "png", 100);
+/**
+ * Note that a genome has been edited.  Requests that are rendering an older
+ * generation of the genome are out of date, so they're stopped.  Stopped
+ * Queued requests are put back in the queue by their workers, and stopped
+ * previews and images are put back here, so each one is rendered again from
+ * the latest edit.  Requests that are waiting copy their genomes when
+ * they're dispatched, so they're always current.
+ */
+void RenderThread::genomeChanged(const flam3_genome* g)
+{
+    QMutexLocker locker(&rqueue_mutex);
+    quint64 gen = ++generations[g];
+    foreach (RenderWorker* w, workers)
+    {
+        RenderRequest* r = w->current();
+        if (r == 0 || r->genome() != g || r->generation() >= gen
+            || r->type() == RenderRequest::File)
+            continue;
 
-        job->setImage(img_buf);
-        job->setFinished(true);
+        logFine("RenderThread::genomeChanged : stopping obsolete req %#x", (long)r);
+        w->stopRendering();
+        if (r->type() == RenderRequest::Preview && preview_request == 0)
+            preview_request = r;
+        else if (r->type() == RenderRequest::Image && image_request == 0)
+            image_request = r;
+    }
+    rqueue_wait.wakeAll();
+}
 
-        // look for a free event
-        RenderEvent* event = 0;
-        foreach (RenderEvent* e, event_list)
-            if (e->accepted())
-            {
-                e->accept(false);
-                event = e;
-                break;
-            }
+/**
+ * Emit a RenderEvent for a finished request.
+ */
+void RenderThread::emitRendered(RenderRequest* job)
+{
+    if (job->finished())
+    {
+        job->stamp(RenderRequest::Times::Emitted);
+        RenderRequest::Times times(job->times());
+        times.name = job->name();
+        times.type = job->type();
+        recordTimes(times);
+    }
 
-        if (!event)
+    // look for a free event
+    event_mutex.lock();
+    RenderEvent* event = 0;
+    foreach (RenderEvent* e, event_list)
+        if (e->accepted())
         {
-            logFinest(QString("RenderThread::run : adding event"));
-            event = new RenderEvent();
-            event->accept(false);
-            event_list.append(event);
+            e->accept(false);
+            event = e;
+            break;
         }
-        logFiner(QString("RenderThread::run : event list size %1")
-                .arg(event_list.size()));
 
-        event->setRequest(job);
-        emit flameRendered(event);
-        logFiner(QString("RenderThread::run : finished"));
-        running_mutex.unlock();
+    if (!event)
+    {
+        logFinest(QString("RenderThread::emitRendered : adding event"));
+        event = new RenderEvent();
+        event->accept(false);
+        event_list.append(event);
     }
+    logFiner(QString("RenderThread::emitRendered : event list size %1")
+            .arg(event_list.size()));
+    event->setRequest(job);
+    event_mutex.unlock();
 
-    logInfo("RenderThread::run : thread exiting");
+    emit flameRendered(event);
 }
 
+/**
+ * Find the busy worker with the most important request.  File requests are
+ * reported first since the progress dialog watches them.
+ */
+RenderWorker* RenderThread::busyWorker(RenderRequest** req) const
+{
+    static const int rank[] = { 1, 2, 0, 3 }; // Preview, Image, File, Queued
+    RenderWorker* worker = 0;
+    *req = 0;
+    foreach (RenderWorker* w, workers)
+    {
+        RenderRequest* r = w->current();
+        if (r && (*req == 0 || rank[r->type()] < rank[(*req)->type()]))
+        {
+            worker = w;
+            *req = r;
+        }
+    }
+    return worker;
+}
 
 RenderStatus& RenderThread::getStatus()
 {
-    status.Name = rtype;
-
-    if (rendering)
+    QMutexLocker locker(&rqueue_mutex);
+    RenderRequest* req;
+    RenderWorker* worker = busyWorker(&req);
+    if (file_finished)
+    {
+        // report a finished file at least once
+        QTime zero;
+        const QTime timer(zero.addMSecs(millis));
+        file_finished = false;
+        status.Name = rtype;
+        status.State = RenderStatus::Idle;
+        status.Type = RenderRequest::File;
+        status.Runtime = timer;
+    }
+    else if (worker && worker->isRendering())
     {
         QTime zero;
-        const QTime time(zero.addMSecs((int)_est_remain));
+        const QTime time(zero.addMSecs((int)worker->estRemain()));
 
+        status.Name = worker->name();
         status.State = RenderStatus::Busy;
-        status.Type = current_request->type();
+        status.Type = req->type();
         status.EstRemain = time;
-        status.Percent = _percent_finished;
+        status.Percent = worker->finished();
     }
-    else if (kill_all_jobs || _stop_current_job)
+    else if (kill_all_jobs)
     {
         status.State = RenderStatus::Killed;
     }
-    else
+    else if (!worker)
     {
         QTime zero;
         const QTime timer(zero.addMSecs(millis));
+        status.Name = rtype;
         status.State = RenderStatus::Idle;
         status.Runtime = timer;
     }
@@ -372,28 +1138,58 @@ RenderStatus& RenderThread::getStatus()
 
 bool RenderThread::isRendering()
 {
-    return render_loop_flag && current_request;
+    RenderRequest* req;
+    busyWorker(&req);
+    return req != 0;
 }
 
 /**
- * stops the current job and clears all remaining requests.
+ * stops the current jobs and clears all remaining requests.
  */
 void RenderThread::killAll()
 {
-    if (render_loop_flag)
+    bool busy = false;
+    rqueue_mutex.lock();
+    foreach (RenderWorker* w, workers)
+        if (w->current())
+        {
+            w->kill();
+            busy = true;
+        }
+    if (busy)
     {
         kill_all_jobs = true;
-        _stop_current_job = true;
+        preview_request = 0;
+        image_request = 0;
+        request_queue.clear();
+        queued.clear();
     }
+    rqueue_mutex.unlock();
+    if (busy)
+        emit flameRenderingKilled();
 }
 
 /**
- * stop the current job and select the next request.
+ * stop the current jobs and select the next requests.
  */
 void RenderThread::stopRendering()
 {
-    if (render_loop_flag)
-        _stop_current_job = true;
+    rqueue_mutex.lock();
+    foreach (RenderWorker* w, workers)
+        w->stopRendering();
+    rqueue_mutex.unlock();
+}
+
+/**
+ * stop rendering the given request if a worker is busy with it.
+ */
+void RenderThread::stopRendering(RenderRequest* req)
+{
+    rqueue_mutex.lock();
+    foreach (RenderWorker* w, workers)
+        if (w->current() == req)
+            w->stopRendering();
+    rqueue_mutex.unlock();
 }
 
 void RenderThread::start()
@@ -405,60 +1201,341 @@ void RenderThread::start()
 void RenderThread::stop()
 {
     running = false;
+    rqueue_mutex.lock();
     preview_request = 0;
     image_request = 0;
-    rqueue_mutex.lock();
     request_queue.clear();
+    queued.clear();
     rqueue_mutex.unlock();
     stopRendering();
 }
 
 double RenderThread::finished()
 {
-    return _percent_finished;
+    RenderRequest* req;
+    RenderWorker* worker = busyWorker(&req);
+    return worker ? worker->finished() : 0.0;
+}
+
+/**
+ * The cache key is a hash of the genomes that are rendered, the image size,
+ * the output format, and the quality presets.
+ */
+QByteArray RenderThread::cacheKey(RenderRequest* req)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    int first = 0;
+    int ngenomes = req->numGenomes();
+    if (ngenomes > 1)
+        control_point_window(req->genome(), ngenomes, req->time(),
+                             &first, &ngenomes);
+    for (int n = 0 ; n < ngenomes ; n++)
+        Util::hash_genome(hash, req->genome() + first + n);
+    // the times of the genomes place the frame between them
+    if (ngenomes > 1)
+        for (int n = 0 ; n < ngenomes ; n++)
+            hash.addData((const char*)&req->genome()[first + n].time, sizeof(double));
+
+    QByteArray params;
+    QDataStream stream(&params, QIODevice::WriteOnly);
+    stream << req->time() << req->size() << (int)img_format << early_clip;
+    const flam3_genome* g = req->imagePresets();
+    if (g->nbatches > 0)
+        stream << g->sample_density << g->spatial_filter_radius
+               << g->spatial_oversample << g->nbatches << g->ntemporal_samples
+               << g->estimator << g->estimator_curve << g->estimator_minimum;
+    hash.addData(params);
+    return hash.result();
+}
+
+/**
+ * Answer a request from the image cache.  Any pending or running work for
+ * the request is dropped, and the RenderEvent is emitted from the event loop
+ * so clients aren't called back from within render().
+ */
+bool RenderThread::cacheHit(RenderRequest* req)
+{
+    if (image_cache.maxCost() == 0)
+        return false;
+
+    QByteArray key(cacheKey(req));
+    cache_mutex.lock();
+    QImage* cached = image_cache.object(key);
+    QImage image;
+    if (cached)
+        image = *cached;
+    cache_mutex.unlock();
+    if (!cached)
+        return false;
+
+    logFine(QString("RenderThread::cacheHit : req 0x%1").arg((long)req,0,16));
+    cancel(req);
+    req->setKey(key);
+    rqueue_mutex.lock();
+    foreach (RenderWorker* w, workers)
+        if (w->current() == req)
+            w->kill();
+    req->setImage(image);
+    req->setPass(req->passes());
+    req->setFinished(true);
+    req->setError(QString());
+    req->setCached();
+    if (!cache_hits.contains(req))
+        cache_hits.append(req);
+    rqueue_mutex.unlock();
+    QMetaObject::invokeMethod(this, "emitCacheHits", Qt::QueuedConnection);
+    return true;
+}
+
+void RenderThread::emitCacheHits()
+{
+    rqueue_mutex.lock();
+    QList<RenderRequest*> hits(cache_hits);
+    cache_hits.clear();
+    rqueue_mutex.unlock();
+    foreach (RenderRequest* req, hits)
+        emitRendered(req);
+}
+
+// Escape a string for a JSON string literal.
+static QString jsonEscape(const QString& in)
+{
+    QString out;
+    out.reserve(in.size());
+    foreach (QChar c, in)
+    {
+        if (c == '\\')
+            out += "\\\\";
+        else if (c == '"')
+            out += "\\\"";
+        else if (c == '\n')
+            out += "\\n";
+        else if (c == '\r')
+            out += "\\r";
+        else if (c == '\t')
+            out += "\\t";
+        else if (c.unicode() < 0x20)
+            out += QString("\\u%1").arg(c.unicode(), 4, 16, QChar('0'));
+        else
+            out += c;
+    }
+    return out;
+}
+
+/**
+ * Keep the timings of a finished request for the metrics panel, and append
+ * them to the trace file if one was given by the qosmic_trace variable.
+ */
+void RenderThread::recordTimes(const RenderRequest::Times& t)
+{
+    timing_mutex.lock();
+    timing_log.append(t);
+    while (timing_log.size() > TIMING_LOG_SIZE)
+        timing_log.removeFirst();
+
+    if (trace_file.isOpen())
+    {
+        typedef RenderRequest::Times T;
+        QString name(t.name);
+        if (trace_json)
+        {
+            name = jsonEscape(name);
+            trace << "{\"time_us\":" << t.stamp[T::Enqueued]
+                << ",\"name\":\"" << name << '"'
+                << ",\"type\":\"" << request_type_names[t.type] << '"'
+                << ",\"cached\":" << (t.cached ? "true" : "false")
+                << ",\"wait_us\":" << t.elapsed(T::Enqueued, T::Dequeued)
+                << ",\"copy_us\":" << t.elapsed(T::Dequeued, T::Copied)
+                << ",\"render_us\":" << t.render_us
+                << ",\"convert_us\":" << t.convert_us
+                << ",\"save_us\":" << t.elapsed(T::Converted, T::Saved)
+                << ",\"total_us\":" << t.elapsed(T::Enqueued, T::Emitted)
+                << ",\"iters\":" << t.iters
+                << ",\"iters_per_sec\":" << t.itersPerSec() << "}\n";
+        }
+        else
+        {
+            name.replace('"', "\"\"");
+            trace << t.stamp[T::Enqueued]
+                << ",\"" << name << "\","
+                << request_type_names[t.type] << ','
+                << (t.cached ? 1 : 0) << ','
+                << t.elapsed(T::Enqueued, T::Dequeued) << ','
+                << t.elapsed(T::Dequeued, T::Copied) << ','
+                << t.render_us << ','
+                << t.convert_us << ','
+                << t.elapsed(T::Converted, T::Saved) << ','
+                << t.elapsed(T::Enqueued, T::Emitted) << ','
+                << t.iters << ','
+                << t.itersPerSec() << '\n';
+        }
+        trace.flush();
+    }
+    timing_mutex.unlock();
+
+    emit timingsUpdated();
+}
+
+/**
+ * Open the trace file.  Files ending in .json get one JSON object per line,
+ * everything else is written as CSV with a header.
+ */
+void RenderThread::openTrace(const QString& path)
+{
+    trace_file.setFileName(path);
+    if (!trace_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        logWarn(QString("RenderThread::openTrace : couldn't open %1").arg(path));
+        return;
+    }
+    logInfo(QString("RenderThread::openTrace : tracing requests to %1").arg(path));
+    trace.setDevice(&trace_file);
+    trace.setRealNumberNotation(QTextStream::FixedNotation);
+    trace.setRealNumberPrecision(0);
+    trace_json = QFileInfo(path).suffix().toLower() == "json";
+    if (!trace_json)
+        trace << "time_us,name,type,cached,wait_us,copy_us,render_us,"
+                 "convert_us,save_us,total_us,iters,iters_per_sec\n";
+}
+
+/**
+ * The timings of the most recently finished requests, oldest first.
+ */
+QList<RenderRequest::Times> RenderThread::timings() const
+{
+    QMutexLocker locker(&timing_mutex);
+    return timing_log;
+}
+
+/**
+ * Microseconds since the RenderThread was created.  Never returns zero so
+ * that a zero stamp always means the stage wasn't reached.
+ */
+qint64 RenderThread::clock()
+{
+    return render_clock.nsecsElapsed() / 1000 + 1;
+}
+
+void RenderThread::cacheImage(const QByteArray& key, const QImage& img)
+{
+    if (key.isEmpty())
+        return;
+    QMutexLocker locker(&cache_mutex);
+    image_cache.insert(key, new QImage(img), img.byteCount());
+}
+
+/**
+ * Set the size of the image cache in bytes.  A size of zero disables the
+ * cache.
+ */
+void RenderThread::setCacheSize(int bytes)
+{
+    QMutexLocker locker(&cache_mutex);
+    image_cache.setMaxCost(qMax(0, bytes));
+    logInfo(QString("RenderThread::setCacheSize : using a %1 byte image cache").arg(bytes));
+}
+
+int RenderThread::cacheSize() const
+{
+    return image_cache.maxCost();
+}
+
+/**
+ * Set the memory budget in megabytes for rendering a File request.  Files
+ * that would need more than this for the flam3 buckets are rendered in
+ * tiles.  A budget of zero disables tiling.
+ */
+void RenderThread::setTileMemory(int mbytes)
+{
+    tile_memory = qMax(0, mbytes) * (qint64)1024 * 1024;
+}
+
+int RenderThread::tileMemory() const
+{
+    return (int)(tile_memory / (1024 * 1024));
 }
 
 void RenderThread::render(RenderRequest* req)
 {
     logFiner(QString("RenderThread::render : req 0x%1").arg((long)req,0,16));
+    req->resetTimes();
+    req->stamp(RenderRequest::Times::Enqueued);
+    if (req->type() != RenderRequest::File && cacheHit(req))
+        return;
+
+    rqueue_mutex.lock();
+    cache_hits.removeAll(req);
     if (req->type() == RenderRequest::Preview)
     {
         preview_request = req;
-        // rendering a preview preempts everything except files and previews
-        if (isRendering())
-            switch (current_request->type())
-            {
-                case RenderRequest::Image:
-                case RenderRequest::Queued:
-                    stopRendering();
-                default:
-                    ;
-            }
+        // rendering a preview preempts everything except files.  a running
+        // preview is stopped too since its remaining passes are out of date.
+        foreach (RenderWorker* w, workers)
+        {
+            RenderRequest* r = w->current();
+            if (r)
+                switch (r->type())
+                {
+                    case RenderRequest::Preview:
+                    case RenderRequest::Image:
+                    case RenderRequest::Queued:
+                        w->stopRendering();
+                    default:
+                        ;
+                }
+        }
     }
     else if (req->type() == RenderRequest::Image)
         image_request = req;
 
-    else if (request_queue.contains(req))
-        logWarn(QString("RenderThread::render : req 0x%1 already queued")
-                .arg((long)req,0,16));
+    // a queued request copies its genome when it's dispatched, so submitting
+    // it again before then is coalesced into the one render.
+    else if (queued.contains(req))
+        logFine("RenderThread::render : req %#x already queued", (long)req);
     else
     {
         logFine("RenderThread::render : queueing req %#x", (long)req);
         req->setFinished(false);
-        rqueue_mutex.lock();
         request_queue.enqueue(req);
+        queued.insert(req);
+    }
+    rqueue_mutex.unlock();
+    rqueue_wait.wakeAll();
+}
+
+/**
+ * Drop a request, and kill it if it's being rendered.  This waits for the
+ * worker to let go of the request so that the caller may delete it.
+ */
+void RenderThread::kill(RenderRequest* req)
+{
+    cancel(req);
+    forever
+    {
+        bool busy = false;
+        rqueue_mutex.lock();
+        foreach (RenderWorker* w, workers)
+            if (w->current() == req)
+            {
+                w->kill();
+                busy = true;
+            }
         rqueue_mutex.unlock();
+        if (!busy)
+            break;
+        msleep(5);
     }
 }
 
 void RenderThread::cancel(RenderRequest* req)
 {
-    if (req->type() == RenderRequest::Queued)
+    QMutexLocker locker(&rqueue_mutex);
+    cache_hits.removeAll(req);
+    if (req->type() == RenderRequest::Queued || req->type() == RenderRequest::File)
     {
-        rqueue_mutex.lock();
         int count = request_queue.removeAll(req);
+        queued.remove(req);
         logFine("RenderThread::cancel : removing %d queued requests", count);
-        rqueue_mutex.unlock();
     }
     else if (req->type() == RenderRequest::Preview)
         preview_request = 0;
@@ -468,6 +1545,22 @@ void RenderThread::cancel(RenderRequest* req)
         logWarn("RenderThread::cancel : unknown request type %d", (int)req->type());
 }
 
+/**
+ * returns the most important request being rendered, or zero if the
+ * workers are idle.
+ */
+RenderRequest* RenderThread::current() const
+{
+    RenderRequest* req;
+    busyWorker(&req);
+    return req;
+}
+
+int RenderThread::numWorkers() const
+{
+    return workers.size();
+}
+
 
 RenderThread::ImageFormat RenderThread::format() const
 {
@@ -488,12 +1581,12 @@ void RenderThread::setFormat(ImageFormat f)
 
 bool RenderThread::earlyClip() const
 {
-    return flame.earlyclip == 1;
+    return early_clip == 1;
 }
 
 void RenderThread::setEarlyClip(bool t)
 {
-    flame.earlyclip = ( t ? 1 : 0 );
+    early_clip = ( t ? 1 : 0 );
 }
 
 // Observer used by renderthread which notifies StatusWatchers
@@ -632,8 +1725,10 @@ bool RenderEvent::accepted() const
 // rendering requests
 RenderRequest::RenderRequest(flam3_genome* g, QSize s, QString n, Type t)
 : m_genome(g), m_genome_template(), m_time(0), m_ngenomes(1), m_type(t),
-    m_size(s), m_name(n), m_finished(true)
+    m_size(s), m_name(n), m_finished(true), m_stats(), m_passes(1), m_pass(1),
+    m_generation(0)
 {
+    m_times.type = t;
 }
 
 
@@ -718,6 +1813,166 @@ void RenderRequest::setFinished(bool value)
     m_finished = value;
 }
 
+/**
+ * The reason the last render of this request failed, or an empty string
+ * if it succeeded.  A failed request is still emitted as finished.
+ */
+QString RenderRequest::error() const
+{
+    return m_error;
+}
+
+void RenderRequest::setError(const QString& value)
+{
+    m_error = value;
+}
+
+bool RenderRequest::failed() const
+{
+    return !m_error.isEmpty();
+}
+
+/**
+ * the flam3_render() statistics for the last time this request was rendered
+ */
+const stat_struct& RenderRequest::stats() const
+{
+    return m_stats;
+}
+
+void RenderRequest::setStats(const stat_struct& stats)
+{
+    m_stats = stats;
+}
+
+/**
+ * the number of progressive passes used to render this request.  the
+ * earlier passes are rendered at lower sizes and sample densities, and an
+ * image is emitted after each pass.
+ */
+int RenderRequest::passes() const
+{
+    return m_passes;
+}
+
+void RenderRequest::setPasses(int n)
+{
+    m_passes = n;
+}
+
+/**
+ * the pass, from 1 to passes(), that produced the current image
+ */
+int RenderRequest::pass() const
+{
+    return m_pass;
+}
+
+void RenderRequest::setPass(int n)
+{
+    m_pass = n;
+}
+
+void RenderRequest::setGeneration(quint64 gen)
+{
+    m_generation = gen;
+}
+
+quint64 RenderRequest::generation() const
+{
+    return m_generation;
+}
+
+/**
+ * The cache key of the genomes that were copied when the request was last
+ * dispatched, or answered from the cache.  It still matches the image after
+ * the genome has been edited.
+ */
+void RenderRequest::setKey(const QByteArray& value)
+{
+    m_key = value;
+}
+
+QByteArray RenderRequest::key() const
+{
+    return m_key;
+}
+
+/**
+ * The timing record is stamped by the workers, and read and reset by the
+ * RenderThread, so it's only used with the request's timing mutex held.
+ */
+RenderRequest::Times RenderRequest::times() const
+{
+    QMutexLocker locker(&m_times_mutex);
+    return m_times;
+}
+
+void RenderRequest::resetTimes()
+{
+    QMutexLocker locker(&m_times_mutex);
+    m_times.reset();
+}
+
+void RenderRequest::stamp(Times::Stamp s)
+{
+    QMutexLocker locker(&m_times_mutex);
+    m_times.stamp[s] = RenderThread::clock();
+}
+
+void RenderRequest::addRenderTime(qint64 us, double iters)
+{
+    QMutexLocker locker(&m_times_mutex);
+    m_times.render_us += us;
+    m_times.iters += iters;
+}
+
+void RenderRequest::addConvertTime(qint64 us)
+{
+    QMutexLocker locker(&m_times_mutex);
+    m_times.convert_us += us;
+}
+
+void RenderRequest::setCached()
+{
+    QMutexLocker locker(&m_times_mutex);
+    m_times.cached = true;
+}
+
+
+RenderRequest::Times::Times()
+: type(RenderRequest::Queued)
+{
+    reset();
+}
+
+void RenderRequest::Times::reset()
+{
+    for (int n = 0 ; n < NumStamps ; n++)
+        stamp[n] = 0;
+    render_us = 0;
+    convert_us = 0;
+    iters = 0.0;
+    cached = false;
+}
+
+/**
+ * Microseconds between two stamps, or -1 if either stage wasn't reached.
+ */
+qint64 RenderRequest::Times::elapsed(Stamp from, Stamp to) const
+{
+    if (stamp[from] == 0 || stamp[to] == 0)
+        return -1;
+    return stamp[to] - stamp[from];
+}
+
+double RenderRequest::Times::itersPerSec() const
+{
+    if (render_us <= 0)
+        return 0.0;
+    return iters * 1000000.0 / render_us;
+}
+
 double RenderRequest::time() const
 {
     return m_time;
@@ -738,9 +1993,3 @@ void RenderRequest::setNumGenomes(int n)
     m_ngenomes = n;
 }
 
-RenderRequest* RenderThread::current() const
-{
-    return current_request;
-}
-
-
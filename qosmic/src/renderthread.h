@@ -25,9 +25,16 @@
 #include <QStatusBar>
 #include <QThread>
 #include <QMutex>
+#include <QWaitCondition>
 #include <QQueue>
+#include <QCache>
+#include <QHash>
+#include <QSet>
+#include <QFile>
+#include <QTextStream>
 
 #include "flam3util.h"
+#include "pointcloud.h"
 
 /**
   * Clients submit a RenderRequest to the RenderThread which calls
@@ -40,6 +47,30 @@ class RenderRequest
     public:
         enum Type { Preview, Image, File, Queued } ;
 
+        /**
+         * The timing record of one request.  Stamps are microseconds on the
+         * RenderThread clock and are zero until the stage is reached.  The
+         * render and convert durations are summed over all passes.
+         */
+        struct Times
+        {
+            enum Stamp { Enqueued, Dequeued, Copied, Rendered, Converted,
+                         Saved, Emitted, NumStamps } ;
+
+            qint64 stamp[NumStamps];
+            qint64 render_us;
+            qint64 convert_us;
+            double iters;
+            bool cached;
+            QString name;
+            Type type;
+
+            Times();
+            void reset();
+            qint64 elapsed(Stamp, Stamp) const;
+            double itersPerSec() const;
+        };
+
     private:
         flam3_genome* m_genome;
         flam3_genome m_genome_template;
@@ -50,6 +81,14 @@ class RenderRequest
         QString m_name;
         QImage m_image;
         bool m_finished;
+        QString m_error;
+        stat_struct m_stats;
+        int m_passes;
+        int m_pass;
+        quint64 m_generation;
+        QByteArray m_key;
+        Times m_times;
+        mutable QMutex m_times_mutex;
         QMutex m_img_mutex;
 
     public:
@@ -74,6 +113,25 @@ class RenderRequest
         QImage& image();
         void setFinished(bool);
         bool finished() const;
+        void setError(const QString&);
+        QString error() const;
+        bool failed() const;
+        void setStats(const stat_struct&);
+        const stat_struct& stats() const;
+        void setPasses(int);
+        int passes() const;
+        void setPass(int);
+        int pass() const;
+        void setGeneration(quint64);
+        quint64 generation() const;
+        void setKey(const QByteArray&);
+        QByteArray key() const;
+        Times times() const;
+        void resetTimes();
+        void stamp(Times::Stamp);
+        void addRenderTime(qint64, double =0.0);
+        void addConvertTime(qint64);
+        void setCached();
 };
 typedef QList<RenderRequest*> RenderRequestList;
 
@@ -154,51 +212,147 @@ class StatusObserver : public QThread
 };
 
 
+class RenderThread;
+
+/**
+ * A RenderWorker owns a flam3_frame and renders one RenderRequest at a time.
+ * The RenderThread hands requests, along with the genomes already copied for
+ * them, to its idle workers.  The progress callback state is kept per worker
+ * so that several requests can be rendered at the same time.
+ */
+class RenderWorker : public QThread
+{
+    Q_OBJECT
+
+    static int _progress_callback(void*, double, int, double);
+
+    RenderThread* rthread;
+    int worker_id;
+    flam3_frame flame;
+    stat_struct stats;
+    QTime ptimer;
+    QImage img_buf;
+    RenderRequest* job;
+    flam3_genome* job_genomes;
+    QByteArray job_key;
+    mutable QMutex job_mutex;
+    QWaitCondition job_ready;
+    QString rtype;
+    volatile bool stop_job;
+    volatile bool kill_job;
+    volatile bool rendering;
+    double est_remain;
+    double percent_finished;
+    int millis;
+    int tiles_done;
+    int tiles_total;
+    int tile_start;
+
+    void renderJob(RenderRequest*, flam3_genome*);
+    void renderPasses(RenderRequest*, flam3_genome*);
+    void renderCloudPass(RenderRequest*, flam3_genome*);
+    void renderTiles(RenderRequest*, flam3_genome*, int, int);
+
+    public:
+        bool running; // flag to kill thread
+        RenderWorker(RenderThread*, int);
+        ~RenderWorker();
+        virtual void run();
+        void start();
+        void stop();
+        void render(RenderRequest*, flam3_genome*, int, int, const QByteArray&);
+        RenderRequest* current() const;
+        bool isRendering() const;
+        void stopRendering();
+        void kill();
+        double estRemain() const;
+        double finished() const;
+        int runtime() const;
+        QString name() const;
+};
+
+
 /**
  * This is the thread that schedules calls to the flam3_render() function.
- * RenderThread serializes all calls to flam3_render(). Clients are notified
- * when their jobs are finished.  Clients submit a RenderRequest to this class,
- * and they catch RenderResponse signals when a job is complete.
+ * RenderThread dispatches requests to a pool of RenderWorkers.  Clients are
+ * notified when their jobs are finished.  Clients submit a RenderRequest to
+ * this class, and they catch RenderResponse signals when a job is complete.
+ *
+ * Preview and Image requests, and File requests, are large jobs.  They are
+ * rendered one at a time using all of the flam3 threads.  Queued requests are
+ * small, and several of them are rendered at once while no large job is
+ * running or waiting.
+ *
+ * Rendered images are kept in an LRU cache keyed by a hash of the genomes,
+ * the image size, and the quality presets.  A request that hits the cache is
+ * answered without being queued.
+ *
+ * File requests too large to render in memory are rendered in tiles and
+ * written to the png a band of rows at a time.
+ *
+ * The chaos game samples of the last previewed and viewed genomes are kept,
+ * so a preview or image that only changes the camera or the tone mapping is
+ * first answered from them, before the full passes are rendered.
  */
 class RenderThread : public QThread, public StatusProvider
 {
     Q_OBJECT
 
+    friend class RenderWorker;
+
     public:
         enum ImageFormat { RGB32, ARGB32_OPAQUE, ARGB32_TRANS } ;
 
     private:
-        static bool _stop_current_job;
-        static double _est_remain;
-        static double _percent_finished;
-        static stat_struct _stats;
-        static QTime ptimer;
-        static int _progress_callback(void*, double, int, double);
         static RenderThread* singleInstance;
 
-        flam3_frame flame;
+        QList<RenderWorker*> workers;
         RenderRequest* preview_request;
         RenderRequest* image_request;
         QList<RenderEvent*> event_list;
+        QMutex event_mutex;
         QQueue<RenderRequest*> request_queue;
+        QSet<RenderRequest*> queued;
+        QHash<const flam3_genome*, quint64> generations;
         QMutex rqueue_mutex;
-        RenderRequest* current_request;
+        QWaitCondition rqueue_wait;
+        QCache<QByteArray, QImage> image_cache;
+        QMutex cache_mutex;
+        QList<RenderRequest*> cache_hits;
+        Util::PointCloud preview_cloud;
+        Util::PointCloud image_cloud;
+        QMutex cloud_mutex;
+        QList<RenderRequest::Times> timing_log;
+        mutable QMutex timing_mutex;
+        QFile trace_file;
+        QTextStream trace;
+        bool trace_json;
         RenderStatus status;
 
         QString msg;
-        bool rendering;
-        bool render_loop_flag;
         bool kill_all_jobs;
-        QImage img_buf;
-        StatusObserver* so;
-        void init_status_cb();
+        bool file_finished;
+        int nthreads;
+        int early_clip;
         int channels;
         int alpha_trans;
         int millis;
+        qint64 tile_memory;
         ImageFormat img_format;
         QString rtype;
+        StatusObserver* so;
 
         RenderThread();
+        RenderRequest* nextRequest(RenderWorker**, int*);
+        flam3_genome* prepareGenomes(RenderRequest*, int*);
+        void requeue(RenderRequest*);
+        void jobFinished(RenderWorker*, RenderRequest*);
+        void emitRendered(RenderRequest*);
+        bool cacheHit(RenderRequest*);
+        void cacheImage(const QByteArray&, const QImage&);
+        RenderWorker* busyWorker(RenderRequest**) const;
+        void recordTimes(const RenderRequest::Times&);
+        void openTrace(const QString&);
 
     public:
         QMutex running_mutex;
@@ -214,21 +368,36 @@ class RenderThread : public QThread, public StatusProvider
         bool earlyClip() const;
         void setEarlyClip(bool);
         RenderRequest* current() const;
+        int numWorkers() const;
         void start();
         void render(RenderRequest*);
         void cancel(RenderRequest*);
+        void stopRendering(RenderRequest*);
+        void kill(RenderRequest*);
+        void genomeChanged(const flam3_genome*);
+        void forgetGenomes(const flam3_genome*, int);
+        void setCacheSize(int);
+        int cacheSize() const;
+        void setTileMemory(int);
+        int tileMemory() const;
+        QByteArray cacheKey(RenderRequest*);
+        QList<RenderRequest::Times> timings() const;
+        static qint64 clock();
 
     public slots:
         void stopRendering();
         void stop();
         void killAll();
 
+    private slots:
+        void emitCacheHits();
+
     signals:
         void flameRenderingKilled();
         void flameRendered(RenderEvent*);
         void statusUpdated(RenderStatus*);
+        void timingsUpdated();
 };
 
 
-
 #endif
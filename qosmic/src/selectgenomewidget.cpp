@@ -128,6 +128,7 @@ void SelectGenomeWidget::configButtonPressedSlot()
 		genomes->setAutoSave(a);
 		if (a == GenomeVector::NeverSave)
 		{
+			Flam3FileStream::cancelAutoSave();
 			QFile asFile(QOSMIC_AUTOSAVE);
 			if (asFile.exists() && !asFile.remove())
 				QMessageBox::warning(this, "Error",
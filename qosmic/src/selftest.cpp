@@ -0,0 +1,388 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <cmath>
+#include <cstring>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include "selftest.h"
+#include "chaosgame.h"
+#include "imageconvert.h"
+#include "logger.h"
+
+// libflam3 internals used to iterate a genome outside of flam3_render()
+extern "C" {
+int prepare_precalc_flags(flam3_genome*);
+void xform_precalc(flam3_genome*, int);
+}
+
+// the seed used unless qosmic_seed is set, the number of samples for each
+// genome, and the largest total variation distance between two histograms
+// of the same attractor.  the sampling noise is around 0.01.
+#define SELFTEST_SEED 1234
+#define SELFTEST_SAMPLES (1 << 21)
+#define SELFTEST_BATCH (1 << 16)
+#define SELFTEST_TOLERANCE 0.05
+
+// the positions are binned over [-3,3]x[-3,3], with one more bin for the
+// points outside of that, and the colors over [0,1].
+#define SELFTEST_GRID 24
+#define SELFTEST_RANGE 3.0
+#define SELFTEST_COLORS 16
+
+// the size of the frames converted by the benchmark, and how long each
+// kernel is run for
+#define BENCHMARK_WIDTH 1920
+#define BENCHMARK_HEIGHT 1080
+#define BENCHMARK_MSECS 1000
+
+namespace Util
+{
+
+/**
+ * Normalized histograms of the positions and colors of a set of samples,
+ * each weighted by its opacity the way flam3_render() weights them.
+ */
+struct Histogram
+{
+	QVector<double> xy;
+	QVector<double> color;
+	int escaped;
+
+	Histogram()
+	: xy(SELFTEST_GRID * SELFTEST_GRID + 1), color(SELFTEST_COLORS), escaped(0)
+	{
+	}
+
+	void add(const double* p, int n)
+	{
+		for (int i = 0 ; i < n ; i++, p += 4)
+		{
+			if (!std::isfinite(p[0]) || !std::isfinite(p[1]) || p[3] <= 0.0)
+			{
+				escaped++;
+				continue;
+			}
+			int ix = (int)std::floor((p[0] + SELFTEST_RANGE) * SELFTEST_GRID / (2.0 * SELFTEST_RANGE));
+			int iy = (int)std::floor((p[1] + SELFTEST_RANGE) * SELFTEST_GRID / (2.0 * SELFTEST_RANGE));
+			if (ix < 0 || ix >= SELFTEST_GRID || iy < 0 || iy >= SELFTEST_GRID)
+				xy[SELFTEST_GRID * SELFTEST_GRID] += p[3];
+			else
+				xy[iy * SELFTEST_GRID + ix] += p[3];
+			int ic = qBound(0, (int)(p[2] * SELFTEST_COLORS), SELFTEST_COLORS - 1);
+			color[ic] += p[3];
+		}
+	}
+
+	void normalize()
+	{
+		double sum(0.0);
+		foreach (double v, xy)
+			sum += v;
+		if (sum <= 0.0)
+			return;
+		for (int n = 0 ; n < xy.size() ; n++)
+			xy[n] /= sum;
+		for (int n = 0 ; n < color.size() ; n++)
+			color[n] /= sum;
+	}
+};
+
+/**
+ * The total variation distance between two normalized histograms.
+ */
+static double distance(const QVector<double>& a, const QVector<double>& b)
+{
+	double d(0.0);
+	for (int n = 0 ; n < a.size() ; n++)
+		d += std::fabs(a[n] - b[n]);
+	return 0.5 * d;
+}
+
+/**
+ * A genome of three contractive xforms that mix the linear variation
+ * with the given one.  The first xform has a post transform, and the last
+ * one has the given opacity.  If final is set, a final xform with a swirl
+ * is added, and if chaos is set the xaos between some of the xforms is
+ * cleared.
+ */
+static void make_genome(flam3_genome* g, int var, bool final, bool chaos, double opacity)
+{
+	static const double offsets[3][2] = { { 0.0, 0.5 }, { -0.5, -0.3 }, { 0.5, -0.3 } };
+
+	*g = flam3_genome();
+	clear_cp(g, flam3_defaults_on);
+	flam3_add_xforms(g, 3, 0, 0);
+	for (int k = 0 ; k < 3 ; k++)
+	{
+		flam3_xform* xf = g->xform + k;
+		xf->density = 1.0;
+		xf->color = k / 2.0;
+		xf->color_speed = 0.5;
+		xf->opacity = 1.0;
+		xf->c[0][0] = 0.5;
+		xf->c[0][1] = 0.1 * (k - 1);
+		xf->c[1][0] = -0.1 * (k - 1);
+		xf->c[1][1] = 0.5;
+		xf->c[2][0] = offsets[k][0];
+		xf->c[2][1] = offsets[k][1];
+		for (int v = 0 ; v < flam3_nvariations ; v++)
+			xf->var[v] = 0.0;
+		xf->var[VAR_LINEAR] = 0.5;
+		xf->var[var] += 0.5;
+	}
+	g->xform[0].post[0][0] = 0.9;
+	g->xform[0].post[0][1] = 0.2;
+	g->xform[0].post[1][0] = -0.2;
+	g->xform[0].post[1][1] = 0.9;
+	g->xform[0].post[2][0] = 0.05;
+	g->xform[2].opacity = opacity;
+
+	if (chaos)
+	{
+		g->chaos_enable = 1;
+		g->chaos[0][0] = 0.0;
+		g->chaos[1][2] = 0.0;
+		g->chaos[2][1] = 0.5;
+	}
+
+	if (final)
+	{
+		flam3_add_xforms(g, 1, 0, 1);
+		flam3_xform* xf = g->xform + g->final_xform_index;
+		xf->density = 0.0;
+		xf->color = 0.5;
+		xf->color_speed = 0.0;
+		xf->opacity = 1.0;
+		for (int v = 0 ; v < flam3_nvariations ; v++)
+			xf->var[v] = 0.0;
+		xf->var[VAR_LINEAR] = 0.8;
+		xf->var[VAR_SWIRL] = 0.2;
+	}
+}
+
+/**
+ * Iterate the genome with libflam3, starting each batch from a new random
+ * point the same way PointCloud::iterate() does.
+ */
+static bool iterate_flam3(flam3_genome* g, Histogram* h, randctx* rc)
+{
+	if (prepare_precalc_flags(g) != 0)
+		return false;
+	for (int n = 0 ; n < g->num_xforms ; n++)
+		xform_precalc(g, n);
+	unsigned short* xform_distrib = flam3_create_xform_distrib(g);
+	if (xform_distrib == 0)
+		return false;
+
+	QVector<double> points(4 * SELFTEST_BATCH);
+	for (int done = 0 ; done < SELFTEST_SAMPLES ; done += SELFTEST_BATCH)
+	{
+		double* p = points.data();
+		p[0] = flam3_random_isaac_11(rc);
+		p[1] = flam3_random_isaac_11(rc);
+		p[2] = flam3_random_isaac_01(rc);
+		p[3] = flam3_random_isaac_01(rc);
+		flam3_iterate(g, SELFTEST_BATCH, 20, p, xform_distrib, rc);
+		h->add(p, SELFTEST_BATCH);
+	}
+	free(xform_distrib);
+	h->normalize();
+	return true;
+}
+
+/**
+ * Iterate the genome with ChaosGame.
+ */
+static bool iterate_native(flam3_genome* g, Histogram* h, randctx* rc)
+{
+	ChaosGame game;
+	if (!game.prepare(g, rc))
+		return false;
+
+	QVector<double> points(4 * SELFTEST_BATCH);
+	for (int done = 0 ; done < SELFTEST_SAMPLES ; done += SELFTEST_BATCH)
+	{
+		game.iterate(SELFTEST_BATCH, points.data(), rc);
+		h->add(points.data(), SELFTEST_BATCH);
+	}
+	h->normalize();
+	return true;
+}
+
+int selftest()
+{
+	static const struct
+	{
+		const char* name;
+		int var;
+		bool final;
+		bool chaos;
+		double opacity;
+	} cases[] = {
+		{ "linear", VAR_LINEAR, false, false, 1.0 },
+		{ "sinusoidal", VAR_SINUSOIDAL, false, false, 1.0 },
+		{ "spherical", VAR_SPHERICAL, false, false, 1.0 },
+		{ "swirl", VAR_SWIRL, false, false, 1.0 },
+		{ "horseshoe", VAR_HORSESHOE, false, false, 1.0 },
+		{ "polar", VAR_POLAR, false, false, 1.0 },
+		{ "handkerchief", VAR_HANDKERCHIEF, false, false, 1.0 },
+		{ "disc", VAR_DISC, false, false, 1.0 },
+		{ "exponential", VAR_EXPONENTIAL, false, false, 1.0 },
+		{ "bubble", VAR_BUBBLE, false, false, 1.0 },
+		{ "eyefish", VAR_EYEFISH, false, false, 1.0 },
+		{ "cylinder", VAR_CYLINDER, false, false, 1.0 },
+		{ "spherical+final", VAR_SPHERICAL, true, false, 1.0 },
+		{ "bubble+chaos", VAR_BUBBLE, false, true, 1.0 },
+		{ "disc+opacity", VAR_DISC, false, false, 0.5 },
+	};
+	static const int ncases = sizeof(cases) / sizeof(cases[0]);
+
+	// use a fixed seed unless one is given, so that a failure can be repeated
+	bool ok;
+	QString(getenv("qosmic_seed")).toUInt(&ok);
+	if (!ok)
+		set_master_seed(SELFTEST_SEED);
+
+	cout << QString(QCoreApplication::translate("CoreApp",
+		"Comparing ChaosGame (%1 kernel) with flam3_iterate, seed %2"))
+		.arg(ChaosGame::kernel()).arg(master_seed()) << endl;
+
+	int nfailed(0);
+	for (int n = 0 ; n < ncases ; n++)
+	{
+		flam3_genome g;
+		make_genome(&g, cases[n].var, cases[n].final, cases[n].chaos,
+			cases[n].opacity);
+		flam3_genome cp = flam3_genome();
+		flam3_copy(&cp, &g);
+
+		randctx rc;
+		Histogram reference;
+		Histogram native;
+		init_randctx(&rc, 2 * n);
+		bool iterated = iterate_flam3(&g, &reference, &rc);
+		init_randctx(&rc, 2 * n + 1);
+		iterated = iterate_native(&cp, &native, &rc) && iterated;
+		clear_cp(&g, flam3_defaults_on);
+		clear_cp(&cp, flam3_defaults_on);
+
+		if (!iterated)
+		{
+			cout << QString("%1: not iterated FAIL").arg(cases[n].name) << endl;
+			nfailed++;
+			continue;
+		}
+
+		double dxy = distance(reference.xy, native.xy);
+		double dc = distance(reference.color, native.color);
+		bool pass = dxy < SELFTEST_TOLERANCE && dc < SELFTEST_TOLERANCE;
+		cout << QString("%1: position %2 color %3 escaped %4/%5 %6")
+			.arg(cases[n].name).arg(dxy, 0, 'f', 4).arg(dc, 0, 'f', 4)
+			.arg(reference.escaped).arg(native.escaped)
+			.arg(pass ? "ok" : "FAIL") << endl;
+		if (!pass)
+			nfailed++;
+	}
+
+	cout << QString(QCoreApplication::translate("CoreApp",
+		"%1 of %2 genomes passed")).arg(ncases - nfailed).arg(ncases) << endl;
+	return nfailed;
+}
+
+/**
+ * Convert a frame one pixel at a time with QImage::setPixel(), the way the
+ * render thread did before the row kernels.  This is the baseline the
+ * kernels are timed against.
+ */
+static void convert_image_setpixel(const unsigned char* in, int channels, QImage& img)
+{
+	for (int h = 0 ; h < img.height() ; h++)
+		for (int w = 0 ; w < img.width() ; w++, in += channels)
+			img.setPixel(QPoint(w, h), channels == 3 ?
+				qRgb(in[0], in[1], in[2]) : qRgba(in[0], in[1], in[2], in[3]));
+}
+
+int benchmark()
+{
+	cout << QString(QCoreApplication::translate("CoreApp",
+		"Converting %1x%2 frames, selected kernel %3"))
+		.arg(BENCHMARK_WIDTH).arg(BENCHMARK_HEIGHT)
+		.arg(convert_image_kernel()) << endl;
+
+	QVector<unsigned char> in(BENCHMARK_WIDTH * BENCHMARK_HEIGHT * 4);
+	for (int n = 0 ; n < in.size() ; n++)
+		in[n] = (unsigned char)((n * 7 + n / 5) & 0xff);
+
+	int mismatches(0);
+	for (int channels = 3 ; channels <= 4 ; channels++)
+	{
+		QImage::Format format = channels == 3 ?
+			QImage::Format_RGB32 : QImage::Format_ARGB32;
+		// the output of every kernel must match the scalar kernel's
+		QImage scalar(BENCHMARK_WIDTH, BENCHMARK_HEIGHT, format);
+		convert_image_with(0, in.constData(), channels, scalar);
+		int nbytes = scalar.bytesPerLine() * scalar.height();
+
+		QImage img(BENCHMARK_WIDTH, BENCHMARK_HEIGHT, format);
+		// kernel -1 is the setPixel() baseline
+		for (int k = -1 ; k < convert_image_kernel_count() ; k++)
+		{
+			QString name(k < 0 ? "setPixel" : convert_image_kernel_name(k));
+			img.fill(0);
+			// one untimed frame to warm the caches
+			if (k < 0)
+				convert_image_setpixel(in.constData(), channels, img);
+			else
+				convert_image_with(k, in.constData(), channels, img);
+			bool same = memcmp(img.constBits(), scalar.constBits(), nbytes) == 0;
+
+			int frames(0);
+			QElapsedTimer timer;
+			timer.start();
+			do
+			{
+				if (k < 0)
+					convert_image_setpixel(in.constData(), channels, img);
+				else
+					convert_image_with(k, in.constData(), channels, img);
+				frames++;
+			}
+			while (timer.elapsed() < BENCHMARK_MSECS);
+			double secs = timer.nsecsElapsed() / 1e9;
+			double mpixels = (double)frames * BENCHMARK_WIDTH * BENCHMARK_HEIGHT / 1e6;
+			cout << QString("%1 channels, %2: %3 Mpixel/s, %4 ms/frame%5")
+				.arg(channels).arg(name, -8)
+				.arg(mpixels / secs, 0, 'f', 1)
+				.arg(1e3 * secs / frames, 0, 'f', 3)
+				.arg(same ? "" : ", output differs from scalar") << endl;
+			if (!same)
+				mismatches++;
+		}
+	}
+	if (mismatches > 0)
+		cerr << QString("%1 conversions differ from the scalar kernel")
+			.arg(mismatches) << endl;
+	return mismatches;
+}
+
+}
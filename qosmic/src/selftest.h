@@ -0,0 +1,42 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+namespace Util
+{
+	/**
+	 * Compare the histograms of the chaos game run with ChaosGame and with
+	 * flam3_iterate() for a fixed seed, on a genome for each variation that
+	 * ChaosGame implements.  Prints a line for each genome, and returns
+	 * the number of genomes whose histograms don't agree.
+	 */
+	int selftest();
+
+	/**
+	 * Time each of the row conversion kernels that this cpu can run on a
+	 * frame sized buffer, and the old QImage::setPixel() loop as a
+	 * baseline, and print the rate of each.  Returns the number of
+	 * conversions whose output differs from the scalar kernel's.
+	 */
+	int benchmark();
+}
+
+#endif // SELFTEST_H
@@ -178,6 +178,7 @@ SheepLoopWidget::SheepLoopWidget(GenomeVector* gv, QWidget* parent) :
 
 	connect(m_runToolButton, SIGNAL(clicked()), this, SLOT(runSheepButtonAction()));
 	connect(m_saveToolButton, SIGNAL(clicked()), this, SIGNAL(saveSheepLoop()));
+	connect(m_exportToolButton, SIGNAL(clicked()), this, SIGNAL(exportSheepLoop()));
 	connect(m_beginBox, SIGNAL(currentIndexChanged(int)), this, SLOT(beginBoxIndexChanged(int)));
 	connect(m_endBox, SIGNAL(currentIndexChanged(int)), this, SLOT(endBoxIndexChanged(int)));
 	connect(m_temporalSamplesEditor, SIGNAL(valueUpdated()), this, SLOT(temporalSamplesUpdated()));
@@ -739,6 +740,10 @@ void SheepLoopWidget::xformAnimateButtonClicked(bool flag)
 	(genome->xform + idx)->animate = flag;
 }
 
+/**
+ * Returns the genomes of the sheep loop that is shown by the loop widget.
+ * The array is shared, and it's freed the next time this is called.
+ */
 flam3_genome* SheepLoopWidget::createSheepLoop(int& ncp)
 {
 	static flam3_genome* sheep = 0;
@@ -752,6 +757,19 @@ flam3_genome* SheepLoopWidget::createSheepLoop(int& ncp)
 		free(sheep);
 		dncp = 0;
 	}
+	sheep = newSheepLoop(dncp);
+	ncp = dncp;
+	return sheep;
+}
+
+/**
+ * Returns a new array of the sheep loop genomes.  The caller owns it, and
+ * frees it with clear_cp() and free().
+ */
+flam3_genome* SheepLoopWidget::newSheepLoop(int& ncp)
+{
+	flam3_genome* sheep = 0;
+	int dncp = 0;
 	int begin_idx = beginIdx(); // on (0, n]
 	int end_idx = endIdx();
 	int num_genomes = (end_idx - begin_idx) + 1;
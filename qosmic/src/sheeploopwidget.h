@@ -134,6 +134,7 @@ class SheepLoopWidget : public QWidget, public QosmicWidget, private Ui::SheepLo
 		int paletteMode() const;
 		AnimationMode animationMode() const;
 		flam3_genome* createSheepLoop(int&);
+		flam3_genome* newSheepLoop(int&);
 
 	public slots:
 		void genomeSelectedSlot(int);
@@ -144,6 +145,7 @@ class SheepLoopWidget : public QWidget, public QosmicWidget, private Ui::SheepLo
 	signals:
 		void runSheepLoop(bool);
 		void saveSheepLoop();
+		void exportSheepLoop();
 
 	protected:
 		void changeEvent(QEvent*);
@@ -18,6 +18,9 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include <QDockWidget>
+#include <QHeaderView>
+#include <QFileInfo>
+#include <QMouseEvent>
 
 #include "statuswidget.h"
 
@@ -25,6 +28,23 @@ StatusWidget::StatusWidget(QWidget* parent)
 	: QWidget(parent)
 {
 	setupUi(this);
+	setToolTip(tr("Click to show the render timings"));
+
+	// the metrics panel lists the timings of recently finished requests
+	m_metrics = new QTreeWidget(this);
+	m_metrics->setWindowFlags(Qt::Tool);
+	m_metrics->setWindowTitle(tr("Render Timings"));
+	m_metrics->setRootIsDecorated(false);
+	m_metrics->setAlternatingRowColors(true);
+	m_metrics->setHeaderLabels(QStringList()
+		<< tr("Request") << tr("Type") << tr("Wait") << tr("Copy")
+		<< tr("Render") << tr("Convert") << tr("Save") << tr("Total")
+		<< tr("Iters/s"));
+	m_metrics->resize(640, 320);
+	m_metrics->hide();
+
+	connect(RenderThread::getInstance(), SIGNAL(timingsUpdated()),
+			this, SLOT(updateTimings()));
 }
 
 StatusWidget::~StatusWidget()
@@ -37,6 +57,65 @@ void StatusWidget::setRenderStatus(RenderStatus* state)
 		m_statusLabel->setText(state->getMessage());
 }
 
+static QString format_ms(qint64 us)
+{
+	if (us < 0)
+		return QString("-");
+	return QString::number(us / 1000.0, 'f', 1);
+}
+
+void StatusWidget::updateTimings()
+{
+	if (!m_metrics->isVisible())
+		return;
+
+	static const char* types[] =
+		{ QT_TR_NOOP("preview"), QT_TR_NOOP("image"),
+		  QT_TR_NOOP("file"), QT_TR_NOOP("queued") };
+	typedef RenderRequest::Times T;
+	QList<T> timings(RenderThread::getInstance()->timings());
+	m_metrics->clear();
+	QList<QTreeWidgetItem*> items;
+	// newest first
+	for (int n = timings.size() - 1 ; n >= 0 ; n--)
+	{
+		const T& t = timings.at(n);
+		QStringList cols;
+		cols << QFileInfo(t.name).fileName()
+			<< (t.cached ? tr("%1 (cached)").arg(tr(types[t.type]))
+				: tr(types[t.type]))
+			<< format_ms(t.elapsed(T::Enqueued, T::Dequeued))
+			<< format_ms(t.elapsed(T::Dequeued, T::Copied))
+			<< format_ms(t.cached ? -1 : t.render_us)
+			<< format_ms(t.cached ? -1 : t.convert_us)
+			<< format_ms(t.elapsed(T::Converted, T::Saved))
+			<< format_ms(t.elapsed(T::Enqueued, T::Emitted))
+			<< (t.cached ? QString("-")
+				: QString::number(t.itersPerSec(), 'f', 0));
+		QTreeWidgetItem* item = new QTreeWidgetItem(cols);
+		for (int c = 2 ; c < cols.size() ; c++)
+			item->setTextAlignment(c, Qt::AlignRight | Qt::AlignVCenter);
+		items << item;
+	}
+	m_metrics->addTopLevelItems(items);
+}
+
+void StatusWidget::mousePressEvent(QMouseEvent* e)
+{
+	if (e->button() == Qt::LeftButton)
+	{
+		m_metrics->setVisible(!m_metrics->isVisible());
+		if (m_metrics->isVisible())
+		{
+			updateTimings();
+			m_metrics->header()->resizeSections(QHeaderView::ResizeToContents);
+			m_metrics->raise();
+		}
+	}
+	else
+		QWidget::mousePressEvent(e);
+}
+
 /*!
     \fn StatusWidget::resizeEvent(QResizeEvent* e)
  */
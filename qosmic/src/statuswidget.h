@@ -22,6 +22,7 @@
 
 #include <QWidget>
 #include <QResizeEvent>
+#include <QTreeWidget>
 
 #include "ui_statuswidget.h"
 #include "renderthread.h"
@@ -36,10 +37,14 @@ class StatusWidget : public QWidget, private Ui::StatusWidget
 
 	public slots:
 		void setRenderStatus(RenderStatus*);
-
+		void updateTimings();
 
 	protected:
 		void resizeEvent(QResizeEvent*);
+		void mousePressEvent(QMouseEvent*);
+
+	private:
+		QTreeWidget* m_metrics;
 };
 
 #endif
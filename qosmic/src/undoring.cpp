@@ -17,28 +17,141 @@
  *   Free Software Foundation, Inc.,                                       *
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
+#include <QVector>
+
 #include "undoring.h"
 #include "logger.h"
 
+// Pack the genome and its xforms into a flat buffer.  The xform, chaos, and
+// edits pointers are cleared, and the motion xforms and the chaos rows are
+// appended after the xforms.
+static QByteArray pack_genome(const flam3_genome* g)
+{
+	QByteArray b;
+	flam3_genome cp;
+	memcpy(&cp, g, sizeof(flam3_genome));
+	cp.xform = 0;
+	cp.chaos = 0;
+	cp.edits = 0;
+	b.append((const char*)&cp, sizeof(flam3_genome));
+	for (int i = 0 ; i < g->num_xforms ; i++)
+	{
+		flam3_xform xf;
+		memcpy(&xf, g->xform + i, sizeof(flam3_xform));
+		xf.motion = 0;
+		b.append((const char*)&xf, sizeof(flam3_xform));
+	}
+	for (int i = 0 ; i < g->num_xforms ; i++)
+		for (int j = 0 ; j < g->xform[i].num_motion ; j++)
+		{
+			flam3_xform xf;
+			memcpy(&xf, g->xform[i].motion + j, sizeof(flam3_xform));
+			xf.motion = 0;
+			xf.num_motion = 0;
+			b.append((const char*)&xf, sizeof(flam3_xform));
+		}
+	if (g->chaos)
+		for (int i = 0 ; i < g->num_xforms ; i++)
+			b.append((const char*)g->chaos[i], g->num_xforms * sizeof(double));
+	return b;
+}
+
+// Unpack a buffer from pack_genome() into the given genome.
+static void unpack_genome(const QByteArray& b, flam3_genome* dst)
+{
+	const char* p = b.constData();
+	const char* end = p + b.size();
+	flam3_genome g;
+	memcpy(&g, p, sizeof(flam3_genome));
+	p += sizeof(flam3_genome);
+
+	QVector<flam3_xform> xforms(g.num_xforms);
+	int nmotion = 0;
+	for (int i = 0 ; i < g.num_xforms ; i++)
+	{
+		memcpy(xforms.data() + i, p, sizeof(flam3_xform));
+		p += sizeof(flam3_xform);
+		nmotion += xforms[i].num_motion;
+	}
+	QVector<flam3_xform> motion(nmotion);
+	if (nmotion > 0)
+	{
+		memcpy(motion.data(), p, nmotion * sizeof(flam3_xform));
+		p += nmotion * sizeof(flam3_xform);
+	}
+	for (int i = 0, m = 0 ; i < g.num_xforms ; i++)
+	{
+		xforms[i].motion = xforms[i].num_motion > 0 ? motion.data() + m : 0;
+		m += xforms[i].num_motion;
+	}
+
+	int nchaos = g.num_xforms * g.num_xforms;
+	QVector<double> chaos;
+	QVector<double*> rows;
+	if (nchaos > 0 && end - p >= (long)(nchaos * sizeof(double)))
+	{
+		chaos.resize(nchaos);
+		memcpy(chaos.data(), p, nchaos * sizeof(double));
+		for (int i = 0 ; i < g.num_xforms ; i++)
+			rows.append(chaos.data() + i * g.num_xforms);
+	}
+
+	g.xform = g.num_xforms > 0 ? xforms.data() : 0;
+	g.chaos = rows.isEmpty() ? 0 : rows.data();
+	g.edits = 0;
+	flam3_copy(dst, &g);
+}
+
+// The compressed xor of two buffers.  The shorter one is padded with zeros.
+static QByteArray make_delta(const QByteArray& a, const QByteArray& b)
+{
+	int n = qMax(a.size(), b.size());
+	QByteArray d(n, '\0');
+	char* dp = d.data();
+	const char* ap = a.constData();
+	const char* bp = b.constData();
+	for (int i = 0 ; i < n ; i++)
+		dp[i] = (i < a.size() ? ap[i] : 0) ^ (i < b.size() ? bp[i] : 0);
+	return qCompress(d);
+}
+
+// Apply a delta from make_delta() to the buffer, leaving len bytes.
+static void apply_delta(QByteArray& b, const QByteArray& delta, int len)
+{
+	QByteArray d = qUncompress(delta);
+	int n = b.size();
+	if (d.size() > n)
+		b.append(QByteArray(d.size() - n, '\0'));
+	char* bp = b.data();
+	const char* dp = d.constData();
+	for (int i = 0 ; i < d.size() ; i++)
+		bp[i] ^= dp[i];
+	b.truncate(len);
+}
+
+
 UndoRing::UndoRing()
 {
 	logFiner("UndoRing::UndoRing() : enter");
-	current = head = -1;
+	current = -1;
+	pending = false;
 }
 
 UndoRing::UndoRing(const UndoRing& in)
 {
 	logFiner("UndoRing::UndoRing(&copy) : enter");
-	current = head = -1;
+	current = -1;
+	pending = false;
 	*this = in;
 }
 
 UndoRing& UndoRing::operator=(const UndoRing& in)
 {
-	for (int n = 0 ; n < UNDORING_SIZE ; n++)
-		ring[n] = in.ring[n];
+	entries = in.entries;
+	packed  = in.packed;
+	state   = in.state;
 	current = in.current;
-	head = in.head;
+	pending = in.pending;
 	return *this;
 }
 
@@ -47,71 +160,147 @@ UndoRing::~UndoRing()
 	clear();
 }
 
+// Store the state handed out by advance().  The previous state keeps only
+// the delta to this one, and the oldest states are dropped to stay within
+// the budget.
+void UndoRing::seal()
+{
+	if (!pending)
+		return;
+	QByteArray b(pack_genome(&state.Genome));
+	if (current > 0)
+		entries[current - 1].Delta = make_delta(packed, b);
+	packed = b;
+
+	Entry& e = entries[current];
+	e.Length = b.size();
+	e.SelectionRect = state.SelectionRect;
+	e.SelectedType  = state.SelectedType;
+	e.NodesO = state.NodesO;
+	e.NodesX = state.NodesX;
+	e.NodesY = state.NodesY;
+	e.Triangles = state.Triangles;
+	e.MarkPos   = state.MarkPos;
+	pending = false;
+
+	while (current > 0 && cost() > UNDORING_BUDGET)
+	{
+		entries.removeFirst();
+		current--;
+	}
+}
+
+// Restore the working state from the current entry.
+void UndoRing::load()
+{
+	const Entry& e = entries.at(current);
+	unpack_genome(packed, &state.Genome);
+	state.SelectionRect = e.SelectionRect;
+	state.SelectedType  = e.SelectedType;
+	state.NodesO = e.NodesO;
+	state.NodesX = e.NodesX;
+	state.NodesY = e.NodesY;
+	state.Triangles = e.Triangles;
+	state.MarkPos   = e.MarkPos;
+}
+
+// Move one entry back (-1) or forward (+1) by applying a single delta.
+void UndoRing::step(int dir)
+{
+	int target = current + dir;
+	const Entry& e = entries.at(dir < 0 ? target : current);
+	apply_delta(packed, e.Delta, entries.at(target).Length);
+	current = target;
+	load();
+}
+
+int UndoRing::cost() const
+{
+	int bytes = packed.size();
+	foreach (const Entry& e, entries)
+		bytes += sizeof(Entry) + e.Delta.size()
+			+ (e.NodesO.size() + e.NodesX.size() + e.NodesY.size()
+			+ e.Triangles.size()) * sizeof(int)
+			+ e.SelectionRect.size() * sizeof(QPointF);
+	return bytes;
+}
+
 UndoState* UndoRing::next()
 {
-	if (current < head)
-		current++;
-	logFine(QString("UndoRing::next : current %1 / [%2,%3]")
+	seal();
+	if (current < entries.size() - 1)
+		step(1);
+	logFine(QString("UndoRing::next : current %1 / [0,%2]")
 			.arg(current)
-			.arg(head - UNDORING_SIZE)
-			.arg(head));
-	return ring + (current % UNDORING_SIZE);
+			.arg(entries.size() - 1));
+	return &state;
 }
 
 UndoState* UndoRing::prev()
 {
+	seal();
 	if (current > 0)
 	{
-		if (current > (head - UNDORING_SIZE + 1))
-			current--;
-		logFine(QString("UndoRing::prev : current %1 / [%2,%3]")
+		step(-1);
+		logFine(QString("UndoRing::prev : current %1 / [0,%2]")
 			.arg(current)
-			.arg(head - UNDORING_SIZE)
-			.arg(head));
-		return ring + (current % UNDORING_SIZE);
+			.arg(entries.size() - 1));
 	}
-	return ring;
+	return &state;
 }
 
 UndoState* UndoRing::advance()
 {
+	seal();
+	while (entries.size() > current + 1)
+		entries.removeLast();
+	entries.append(Entry());
 	current++;
-	head = current;
+	state.SelectionRect = QPolygonF();
+	state.SelectedType = 0;
+	state.NodesO.clear();
+	state.NodesX.clear();
+	state.NodesY.clear();
+	state.Triangles.clear();
+	state.MarkPos = QPointF();
+	pending = true;
 	logFine(QString("UndoRing::advance : current %1").arg(current));
-	return ring + (current % UNDORING_SIZE);
+	return &state;
 }
 
 UndoState* UndoRing::currentState()
 {
-	return ring + (current % UNDORING_SIZE);
+	return &state;
 }
 
 void UndoRing::clear()
 {
 	logFiner(QString("UndoRing::clear : enter"));
-	for (int n = 0 ; n < UNDORING_SIZE ; n++)
-		(ring + n)->clear();
-	current = head = -1;
+	entries.clear();
+	packed.clear();
+	state.clear();
+	current = -1;
+	pending = false;
 }
 
 bool UndoRing::atHead()
 {
-	return current == head;
+	return current == entries.size() - 1;
 }
 
 bool UndoRing::atTail()
 {
-	return current == (head - UNDORING_SIZE + 1) || current <= 0;
+	return current <= 0;
 }
 
 int UndoRing::index()
 {
-	return (head - current + 1);
+	return entries.size() - current;
 }
 
 int UndoRing::size()
 {
-	return UNDORING_SIZE;
+	return entries.size();
 }
 
 
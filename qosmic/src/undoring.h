@@ -24,7 +24,8 @@
 
 #include "flam3util.h"
 
-#define UNDORING_SIZE 50
+// the number of bytes each UndoRing may use for its history
+#define UNDORING_BUDGET (256*1024)
 
 class UndoState
 {
@@ -51,12 +52,40 @@ class UndoStateProvider
 		virtual void restoreState(UndoState*) =0;
 };
 
+/**
+ * The UndoRing keeps the undo history for one genome.  Only the current
+ * state is kept as a full snapshot.  Every other state is reached by
+ * applying compressed diffs to that snapshot, one for each step.  The oldest
+ * states are dropped once the diffs use more than UNDORING_BUDGET bytes.
+ *
+ * The UndoState returned by advance() is filled in by the caller, so it is
+ * stored when the ring is next moved.
+ */
 class UndoRing
 {
-	qint64 head;
-	qint64 current;
+	struct Entry
+	{
+		QByteArray Delta; // diff between this state and the next one
+		int Length;       // length of this state's packed genome
+		QPolygonF SelectionRect;
+		int SelectedType;
+		QList<int> NodesO;
+		QList<int> NodesX;
+		QList<int> NodesY;
+		QList<int> Triangles;
+		QPointF MarkPos;
+	};
+
+	QList<Entry> entries;
+	QByteArray packed;   // the packed genome of the current state
+	UndoState state;
+	int current;
+	bool pending;
 
-	UndoState ring[UNDORING_SIZE];
+	void seal();
+	void load();
+	void step(int);
+	int cost() const;
 
 	public:
 		UndoRing();
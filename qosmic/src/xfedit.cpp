@@ -90,6 +90,10 @@ FigureEditor::FigureEditor(GenomeVector* g, QObject* parent)
 	transform_location = (SceneLocation)settings.value("transformlocation", (int)Origin).toInt();
 	editMode = (EditMode)settings.value("editmode", (int)Move).toInt();
 
+	previewThread = new XformPreviewThread(this);
+	connect(previewThread, SIGNAL(previewReady()),
+			this, SLOT(xformPreviewReadyAction()), Qt::QueuedConnection);
+
 	setBackgroundBrush(Qt::black);
 	basisTriangle->setGraphicsScene(this);
 	addItem(basisTriangle);
@@ -146,6 +150,7 @@ FigureEditor::FigureEditor(GenomeVector* g, QObject* parent)
 
 FigureEditor::~FigureEditor()
 {
+	previewThread->stop();
 	delete selectionItem;
 	delete graphicsGuide;
 	delete postTriangle;
@@ -1196,44 +1201,20 @@ void FigureEditor::createXformPreview()
 {
 	int xi = selectedTriangleIndex();
 	logFiner(QString("FigureEditor::createXformPreview : xi = %1").arg(xi));
-	double range = 1.0;
-	int numvals = preview_density;
-	int depth = preview_depth;
-	int rcnt = 2* (2*numvals+1)*(2*numvals+1);
-	QVector<double>* result;
-	randctx* rc = Util::get_isaac_randctx();
-	flam3_genome g = flam3_genome();
-	for (int n = 0 ; n < depth ; n++)
-	{
-		if (n < xformPreview.size())
-		{
-			result = xformPreview.at(n);
-			result->resize(rcnt);
-		}
-		else
-		{
-			result = new QVector<double>(rcnt);
-			xformPreview.append(result);
-		}
-		flam3_copy(&g, genomes->selectedGenome());
-		flam3_xform_preview(&g, xi, range, numvals, n+1, result->data(), rc);
-	}
-	clear_cp(&g, flam3_defaults_on);
-	while ( xformPreview.size() > depth )
-	{
-		QVector<double>*result = xformPreview.last();
-		xformPreview.pop_back();
-		delete result;
-	}
+	previewThread->request(genomes->selectedGenome(), xi,
+		preview_density, preview_depth);
+}
+
+void FigureEditor::xformPreviewReadyAction()
+{
+	xformPreview = previewThread->result();
+	update();
 }
 
 void FigureEditor::updatePreview()
 {
 	if (preview_visible)
-	{
 		createXformPreview();
-		update();
-	}
 }
 
 void FigureEditor::reset()
@@ -1426,18 +1407,12 @@ void FigureEditor::drawBackground(QPainter* p, const QRectF& r)
 			p->drawLine(QPointF(rect.x(), n), QPointF(rect.width(), n));
 	}
 
-	if (preview_visible)
+	if (preview_visible && selectedTriangle)
 	{
-		int numvals = preview_density;
-		int depth = preview_depth;
-		int rcnt = 2* (2*numvals+1)*(2*numvals+1);
+		QTransform t(selectedTriangle->sceneTransform());
 		p->setPen(selectedTriangle->pen());
-		for (int n = 0 ; n < depth ; n++)
-		{
-			double* result = xformPreview.at(n)->data();
-			for (int i = 0 ; i < rcnt  ; i+=2)
-				p->drawPoint(selectedTriangle->mapToScene(result[i], -(result[i+1])));
-		}
+		foreach (const QPolygonF& points, xformPreview)
+			p->drawPoints(t.map(points));
 	}
 }
 
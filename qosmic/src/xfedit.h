@@ -38,6 +38,7 @@
 #include "transformablegraphicsguide.h"
 #include "posttriangle.h"
 #include "undoring.h"
+#include "xformpreview.h"
 
 
 typedef QList<Triangle*> TriangleList;
@@ -168,6 +169,7 @@ class FigureEditor : public QGraphicsScene, public QosmicWidget, public UndoStat
 
 	private slots:
 		void triangleMenuAction(QAction*);
+		void xformPreviewReadyAction();
 
 	private:
 		QAbstractGraphicsShapeItem* moving;
@@ -204,7 +206,8 @@ class FigureEditor : public QGraphicsScene, public QosmicWidget, public UndoStat
 		SceneLocation centered_scaling;
 		SceneLocation transform_location;
 		QVector<flam3_xform> xformClip;
-		QVector<QVector<double>*> xformPreview;
+		QVector<QPolygonF> xformPreview;
+		XformPreviewThread* previewThread;
 		EditMode editMode;
 		bool move_edge_mode;
 		bool has_selection;
@@ -0,0 +1,154 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <cstring>
+
+#include "xformpreview.h"
+#include "logger.h"
+
+// These are part of libflam3, but they are only declared in its private
+// variations.h header.  flam3_xform_preview() uses them the same way.
+extern "C" {
+int prepare_precalc_flags(flam3_genome*);
+void xform_precalc(flam3_genome*, int);
+int apply_xform(flam3_genome*, int, double*, double*, randctx*);
+}
+
+XformPreviewThread::XformPreviewThread(QObject* parent)
+: QThread(parent), genome(), xform_idx(-1), density(0), depth(0),
+  generation(0), done_generation(0), running(true)
+{
+	Util::init_randctx(&rc, Util::next_stream());
+}
+
+XformPreviewThread::~XformPreviewThread()
+{
+	stop();
+	clear_cp(&genome, flam3_defaults_on);
+}
+
+/**
+ * Queue a preview of xform xi in the genome.  The genome is copied, and any
+ * preview still being computed is abandoned.
+ */
+void XformPreviewThread::request(flam3_genome* g, int xi, int num, int levels)
+{
+	QMutexLocker locker(&mutex);
+	flam3_copy(&genome, g);
+	xform_idx = xi;
+	density = num;
+	depth = levels;
+	generation++;
+	if (!isRunning())
+		start(QThread::LowPriority);
+	wait_cond.wakeOne();
+}
+
+/**
+ * Returns the points for each depth level of the newest finished preview.
+ * The points are in the xform's coordinates, with y flipped for the scene.
+ */
+QVector<QPolygonF> XformPreviewThread::result()
+{
+	QMutexLocker locker(&mutex);
+	return points;
+}
+
+void XformPreviewThread::stop()
+{
+	mutex.lock();
+	running = false;
+	wait_cond.wakeOne();
+	mutex.unlock();
+	wait();
+}
+
+bool XformPreviewThread::stale(int gen)
+{
+	QMutexLocker locker(&mutex);
+	return gen != generation || !running;
+}
+
+void XformPreviewThread::run()
+{
+	flam3_genome g = flam3_genome();
+	forever
+	{
+		mutex.lock();
+		while (running && done_generation == generation)
+			wait_cond.wait(&mutex);
+		if (!running)
+		{
+			mutex.unlock();
+			break;
+		}
+		int gen = generation;
+		int xi = xform_idx;
+		int numvals = density;
+		int levels = depth;
+		flam3_copy(&g, &genome);
+		mutex.unlock();
+
+		QVector<QPolygonF> result;
+		// like flam3_xform_preview(), weight the xform so that its
+		// variations are prepared even if it's disabled
+		if (xi >= 0 && xi < g.num_xforms)
+			g.xform[xi].density = 1.0;
+		if (xi >= 0 && xi < g.num_xforms && prepare_precalc_flags(&g) == 0)
+		{
+			xform_precalc(&g, xi);
+			double incr = 1.0 / (double)numvals;
+			int side = 2*numvals + 1;
+			QVector<double> pts(side*side*4);
+			double* p = pts.data();
+			for (int xx = -numvals ; xx <= numvals ; xx++)
+				for (int yy = -numvals ; yy <= numvals ; yy++, p += 4)
+				{
+					p[0] = (double)xx * incr;
+					p[1] = (double)yy * incr;
+					p[2] = p[3] = 0.0;
+				}
+
+			// each level applies the xform once more to the previous level
+			for (int n = 0 ; n < levels && !stale(gen) ; n++)
+			{
+				QPolygonF level(side*side);
+				p = pts.data();
+				for (int i = 0 ; i < side*side ; i++, p += 4)
+				{
+					apply_xform(&g, xi, p, p, &rc);
+					level[i] = QPointF(p[0], -p[1]);
+				}
+				result.append(level);
+			}
+		}
+
+		mutex.lock();
+		bool current = gen == generation;
+		done_generation = gen;
+		if (current)
+			points = result;
+		mutex.unlock();
+		if (current)
+			emit previewReady();
+		else
+			logFiner("XformPreviewThread::run : dropping stale preview");
+	}
+	clear_cp(&g, flam3_defaults_on);
+}
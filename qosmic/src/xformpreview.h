@@ -0,0 +1,69 @@
+/***************************************************************************
+ *   Copyright (C) 2007, 2008, 2009, 2011 by David Bitseff                 *
+ *   bitsed@gmail.com                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef XFORMPREVIEW_H
+#define XFORMPREVIEW_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QPolygonF>
+#include <QVector>
+
+#include "flam3util.h"
+
+/**
+ * Computes the xform preview shown behind the selected triangle in the
+ * FigureEditor.  A grid of points is run through the xform once for each
+ * depth level, and each level starts from the points of the previous one.
+ * Only the newest request is computed, and older ones are dropped as soon
+ * as a newer one arrives.  previewReady() is emitted when the points for
+ * the newest request are done.
+ */
+class XformPreviewThread : public QThread
+{
+	Q_OBJECT
+
+	flam3_genome genome;
+	int xform_idx;
+	int density;
+	int depth;
+	int generation;
+	int done_generation;
+	bool running;
+	QVector<QPolygonF> points;
+	randctx rc;
+	QMutex mutex;
+	QWaitCondition wait_cond;
+
+	bool stale(int);
+
+	public:
+		XformPreviewThread(QObject* =0);
+		~XformPreviewThread();
+		void request(flam3_genome*, int, int, int);
+		QVector<QPolygonF> result();
+		void stop();
+		void run();
+
+	signals:
+		void previewReady();
+};
+
+#endif